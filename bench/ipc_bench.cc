@@ -0,0 +1,355 @@
+/**
+ * Measures the cost of function calls through a channel.
+ *
+ * The benchmark forks its own server process and prints one JSON object per measurement (JSON lines), so
+ * the output of two builds can be compared directly:
+ *
+ * ipc-bench [--iterations N] [--clients N] [--duration-ms N] [--workers N] [--lanes N] [--max-payload BYTES]
+ *
+ * 1. latency: Round trip latency percentiles and a log2 histogram per signature.
+ * 2. payload: Latency and bandwidth of string and view arguments of growing size.
+ * 3. throughput: Calls per second of 1 to --clients client processes calling concurrently, every client
+ *    submits to the lane of its CPU.
+ * 4. pipelined / batch: Calls per second of a single thread with many calls in flight.
+ */
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fn/fn.h>
+#include <fn/fn_invoker.h>
+#include <fn/fn_registry.h>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct BenchOptions {
+        size_t iterations = 20000;
+        size_t clients = 4;
+        size_t duration_ms = 1000;
+        size_t workers = 0;
+        size_t lanes = 1;
+        size_t max_payload = 1024 * 1024;
+    };
+
+    uint64_t elapsedNs(Clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    }
+
+    /**
+     * Runs the registry in a child process, returns once the channel is created.
+     */
+    pid_t startServer(const std::string& channel_name, const BenchOptions& bench_options) {
+        int ready[2];
+        if (pipe(ready) == -1) {
+            throw std::runtime_error("Failed to create pipe");
+        }
+
+        pid_t pid = fork();
+        if (pid == -1) {
+            throw std::runtime_error("Failed to fork the server");
+        }
+
+        if (pid == 0) {
+            /// Keep the output of the registry out of the results
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            close(ready[0]);
+
+            IPC::ChannelOptions options;
+            options.worker_count = bench_options.workers;
+            options.lane_count = bench_options.lanes;
+            options.pin_lanes = bench_options.lanes > 1;
+
+            IPC::FunctionRegistry registry(channel_name, options);
+            registry.registerFunction<void>("noop", std::function<void()>([] {}));
+            registry.registerFunction<int, int, int>("add", std::function<int(int, int)>([](int a, int b) {
+                return a + b;
+                }));
+            registry.registerFunction<std::string, std::string>("echo", std::function<std::string(std::string)>(
+                [](std::string value) { return value; }));
+            registry.registerFunction<uint64_t, std::string_view>("length", std::function<uint64_t(std::string_view)>(
+                [](std::string_view value) { return (uint64_t)value.size(); }));
+
+            char byte = 1;
+            if (write(ready[1], &byte, 1) != 1) {
+                _exit(1);
+            }
+            close(ready[1]);
+
+            registry.listen();
+            _exit(0);
+        }
+
+        close(ready[1]);
+        char byte;
+        if (read(ready[0], &byte, 1) != 1) {
+            throw std::runtime_error("Server failed to start");
+        }
+        close(ready[0]);
+        return pid;
+    }
+
+    void stopServer(pid_t pid, const std::string& channel_name) {
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+
+        /// The registry is killed while listening, so its shared memory is removed here
+        shm_unlink(channel_name.c_str());
+        shm_unlink(IPC::Stats::getShmName(channel_name).c_str());
+    }
+
+    /**
+     * Prints the percentiles and the log2 histogram of the samples.
+     */
+    void printLatency(const std::string& benchmark, const std::string& name, std::vector<uint64_t>& samples,
+        const std::string& extra = "") {
+        std::sort(samples.begin(), samples.end());
+
+        auto percentile = [&samples](double p) {
+            size_t index = std::min(samples.size() - 1, (size_t)(p * samples.size()));
+            return samples[index];
+        };
+
+        uint64_t total = 0;
+        std::vector<uint64_t> buckets(64, 0);
+        for (uint64_t sample : samples) {
+            total += sample;
+            buckets[sample == 0 ? 0 : 63 - __builtin_clzll(sample)]++;
+        }
+
+        std::ostringstream out;
+        out << "{\"benchmark\":\"" << benchmark << "\",\"name\":\"" << name << "\"" << extra
+            << ",\"iterations\":" << samples.size()
+            << ",\"mean_ns\":" << total / samples.size()
+            << ",\"p50_ns\":" << percentile(0.5)
+            << ",\"p90_ns\":" << percentile(0.9)
+            << ",\"p99_ns\":" << percentile(0.99)
+            << ",\"p999_ns\":" << percentile(0.999)
+            << ",\"max_ns\":" << samples.back()
+            << ",\"histogram_ns\":[";
+
+        /// Every bucket holds the samples from 2^i up to 2^(i + 1) nanoseconds
+        bool first = true;
+        for (size_t i = 0; i < buckets.size(); i++) {
+            if (buckets[i] == 0) continue;
+            out << (first ? "" : ",") << "[" << (1ull << i) << "," << buckets[i] << "]";
+            first = false;
+        }
+        out << "]}";
+        std::cout << out.str() << std::endl;
+    }
+
+    uint64_t median(std::vector<uint64_t> samples) {
+        std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+        return samples[samples.size() / 2];
+    }
+
+    template <typename Call>
+    std::vector<uint64_t> measure(size_t iterations, Call call) {
+        /// Warm up the slots and the spin budgets
+        for (size_t i = 0; i < std::min<size_t>(iterations / 10, 1000); i++) {
+            call();
+        }
+
+        std::vector<uint64_t> samples(iterations);
+        for (size_t i = 0; i < iterations; i++) {
+            Clock::time_point start = Clock::now();
+            call();
+            samples[i] = elapsedNs(start);
+        }
+        return samples;
+    }
+
+    void benchLatency(IPC::FunctionInvoker& invoker, const BenchOptions& options) {
+        auto noop = invoker.resolve<void()>("noop");
+        auto add = invoker.resolve<int(int, int)>("add");
+        auto echo = invoker.resolve<std::string(std::string)>("echo");
+
+        std::vector<uint64_t> samples = measure(options.iterations, [&] { invoker.call(noop); });
+        printLatency("latency", "void()", samples);
+
+        samples = measure(options.iterations, [&] { invoker.call(add, 1, 2); });
+        printLatency("latency", "int(int,int)", samples);
+
+        samples = measure(options.iterations, [&] { invoker.call<int(int, int)>("add", 1, 2); });
+        printLatency("latency", "int(int,int) by name", samples);
+
+        samples = measure(options.iterations, [&] { invoker.invoke<int>("add", { 1, 2 }); });
+        printLatency("latency", "int(int,int) invoke", samples);
+
+        std::string value(16, 'x');
+        samples = measure(options.iterations, [&] { invoker.call(echo, value); });
+        printLatency("latency", "string(string)", samples);
+    }
+
+    void benchPayload(IPC::FunctionInvoker& invoker, const BenchOptions& options) {
+        auto echo = invoker.resolve<std::string(std::string)>("echo");
+        auto length = invoker.resolve<uint64_t(std::string_view)>("length");
+
+        for (size_t size = 16; size <= options.max_payload; size *= 4) {
+            std::string value(size, 'x');
+            size_t iterations = std::max<size_t>(100, std::min<size_t>(options.iterations, (64ull << 20) / size));
+
+            /// Bandwidth at the median latency, the echo moves the payload both ways
+            std::vector<uint64_t> samples = measure(iterations, [&] { invoker.call(echo, value); });
+            printLatency("payload", "string(string)", samples, ",\"payload_bytes\":" + std::to_string(size)
+                + ",\"mb_per_s\":" + std::to_string(2.0 * size * 1000.0 / std::max<uint64_t>(1, median(samples))));
+
+            samples = measure(iterations, [&] { invoker.call(length, std::string_view(value)); });
+            printLatency("payload", "uint64(string_view)", samples, ",\"payload_bytes\":" + std::to_string(size)
+                + ",\"mb_per_s\":" + std::to_string(size * 1000.0 / std::max<uint64_t>(1, median(samples))));
+        }
+    }
+
+    /**
+     * Calls add from client_count processes for the configured duration and prints the calls per second.
+     */
+    void benchThroughput(const std::string& channel_name, const BenchOptions& options, size_t client_count) {
+        int counts[2];
+        if (pipe(counts) == -1) {
+            throw std::runtime_error("Failed to create pipe");
+        }
+
+        std::vector<pid_t> clients;
+        for (size_t i = 0; i < client_count; i++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(counts[0]);
+                IPC::FunctionInvoker invoker(channel_name);
+                auto add = invoker.resolve<int(int, int)>("add");
+
+                uint64_t calls = 0;
+                Clock::time_point start = Clock::now();
+                while (elapsedNs(start) < options.duration_ms * 1000000ull) {
+                    invoker.call(add, 1, 2);
+                    calls++;
+                }
+
+                bool written = write(counts[1], &calls, sizeof(calls)) == sizeof(calls);
+                _exit(written ? 0 : 1);
+            }
+            clients.push_back(pid);
+        }
+        close(counts[1]);
+
+        uint64_t total = 0;
+        uint64_t calls;
+        while (read(counts[0], &calls, sizeof(calls)) == sizeof(calls)) {
+            total += calls;
+        }
+        close(counts[0]);
+
+        for (pid_t pid : clients) {
+            waitpid(pid, nullptr, 0);
+        }
+
+        std::cout << "{\"benchmark\":\"throughput\",\"name\":\"int(int,int)\",\"clients\":" << client_count
+            << ",\"lanes\":" << options.lanes
+            << ",\"calls\":" << total
+            << ",\"calls_per_s\":" << (uint64_t)(total * 1000.0 / options.duration_ms) << "}" << std::endl;
+    }
+
+    /**
+     * Calls per second of a single thread that keeps depth calls in flight, through futures and batches.
+     */
+    void benchPipelined(IPC::FunctionInvoker& invoker, const BenchOptions& options, size_t depth) {
+        auto add = invoker.resolve<int(int, int)>("add");
+
+        Clock::time_point start = Clock::now();
+        std::vector<IPC::CallFuture<int>> calls;
+        for (size_t i = 0; i < options.iterations; i += depth) {
+            for (size_t j = 0; j < depth; j++) {
+                calls.push_back(invoker.callAsync(add, 1, 2));
+            }
+            for (auto& call : calls) {
+                call.get();
+            }
+            calls.clear();
+        }
+        uint64_t elapsed = elapsedNs(start);
+        std::cout << "{\"benchmark\":\"pipelined\",\"name\":\"int(int,int)\",\"depth\":" << depth
+            << ",\"calls_per_s\":" << (uint64_t)(options.iterations * 1e9 / elapsed) << "}" << std::endl;
+
+        IPC::CallBatch batch;
+        for (size_t j = 0; j < depth; j++) {
+            batch.add(add, 1, 2);
+        }
+
+        start = Clock::now();
+        for (size_t i = 0; i < options.iterations; i += depth) {
+            invoker.invokeBatch(batch);
+        }
+        elapsed = elapsedNs(start);
+        std::cout << "{\"benchmark\":\"batch\",\"name\":\"int(int,int)\",\"batch_size\":" << depth
+            << ",\"calls_per_s\":" << (uint64_t)(options.iterations * 1e9 / elapsed) << "}" << std::endl;
+    }
+
+    BenchOptions parseOptions(int argc, char** argv) {
+        BenchOptions options;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (i + 1 >= argc) {
+                throw std::runtime_error("Missing value for " + arg);
+            }
+
+            size_t value = std::stoull(argv[++i]);
+            if (arg == "--iterations") options.iterations = std::max<size_t>(1, value);
+            else if (arg == "--clients") options.clients = std::max<size_t>(1, value);
+            else if (arg == "--duration-ms") options.duration_ms = std::max<size_t>(1, value);
+            else if (arg == "--workers") options.workers = value;
+            else if (arg == "--lanes") options.lanes = std::max<size_t>(1, value);
+            else if (arg == "--max-payload") options.max_payload = value;
+            else throw std::runtime_error("Unknown option " + arg);
+        }
+        return options;
+    }
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    try {
+        options = parseOptions(argc, argv);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << "Usage: ipc-bench [--iterations N] [--clients N] [--duration-ms N] [--workers N] [--lanes N] "
+            << "[--max-payload BYTES]"
+            << std::endl;
+        return 1;
+    }
+
+    std::string channel_name = "ipc-bench-" + std::to_string(getpid());
+    pid_t server = startServer(channel_name, options);
+
+    try {
+        IPC::FunctionInvoker invoker(channel_name);
+
+        benchLatency(invoker, options);
+        benchPayload(invoker, options);
+        for (size_t clients = 1; clients <= options.clients; clients++) {
+            benchThroughput(channel_name, options, clients);
+        }
+        benchPipelined(invoker, options, 32);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        stopServer(server, channel_name);
+        return 1;
+    }
+
+    stopServer(server, channel_name);
+    return 0;
+}
@@ -7,8 +7,8 @@ int main() {
     std::cout << "Running IPC client..." << std::endl;
 
     IPC::FunctionInvoker invoker("sample-ipc");
-    std::any ret = invoker.invoke<int>("add", { 1,2 });
+    int ret = invoker.call<int(int, int)>("add", 1, 2);
 
-    std::cout << "Result: " << std::any_cast<int>(ret) << std::endl;
+    std::cout << "Result: " << ret << std::endl;
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,26 @@
+#include <iostream>
+#include <thread>
+
+#include <fn/fn_stats.h>
+
+int main() {
+    IPC::StatsReader reader("sample-ipc");
+
+    while (true) {
+        IPC::StatsSnapshot stats = reader.read();
+
+        std::cout << "queue depth: " << stats.queue_depth << ", dispatch depth: " << stats.dispatch_depth
+            << ", slot memory: " << stats.slot_memory << ", parks: " << stats.parks
+            << ", expired: " << stats.expired << ", rejected: " << stats.rejected << std::endl;
+        for (const auto& function : stats.functions) {
+            std::cout << "  " << function.name << ": " << function.calls << " calls, "
+                << function.in_flight << " in flight, "
+                << (function.calls ? function.total_ns / function.calls : 0) << " ns avg, "
+                << function.cache_hits << " cache hits" << std::endl;
+        }
+
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    return 0;
+}
@@ -2,16 +2,67 @@
 
 #include <vector>
 #include <functional>
-#include <any>
 #include <string>
 #include <tuple>
 #include <stdexcept>
 #include <iostream>
+#include <atomic>
+#include <memory>
+
+#include <fn/fn_cache.h>
+#include <fn/fn_codec.h>
+#include <fn/fn_stream.h>
 
 namespace IPC {
     /**
-     * This is a class that wraps a function and allows it to be called with a vector of std::any arguments.
-     * The function is called with the arguments unpacked from the vector.
+     * Options of a function registered in the FunctionRegistry.
+     */
+    struct FunctionOptions {
+        /**
+         * True if calls to the function may run concurrently on several dispatch workers. False serializes the
+         * calls, use it for functions that are not thread safe. The registry parks a call that arrives while
+         * another one runs, so no dispatch thread waits for the function.
+         */
+        bool reentrant = true;
+
+        /**
+         * Number of results of the function the registry caches, 0 disables the cache. Only for pure functions
+         * whose return value depends on nothing but their arguments: a call whose encoded arguments match a
+         * cached call gets the cached return value without running the function.
+         */
+        size_t cache_size = 0;
+
+        /// How long a cached result stays valid, -1 forever.
+        int64_t cache_ttl_ms = -1;
+
+        /**
+         * Maximum number of calls of the function queued or running at once, 0 for no limit. Further calls are
+         * rejected as busy, so that a slow function cannot take all dispatch threads and queue slots.
+         */
+        uint32_t max_pending = 0;
+
+        /**
+         * Publishes the cache settings in the method table, so that invokers also cache the results of the
+         * function and answer repeated call()s without a round trip to the registry.
+         */
+        bool client_cache = false;
+    };
+
+    /**
+     * Names a free function (or a static member function) at compile time, so that the Function calls it
+     * directly instead of through a std::function, see FunctionRegistry::registerFunction<Fn>().
+     */
+    template <auto Fn>
+    struct FunctionPointer {};
+
+    /**
+     * This is a class that wraps a function and allows it to be called with arguments encoded in a buffer.
+     * The arguments are decoded with the codecs of the function signature, the return value is encoded into
+     * the response buffer the same way.
+     *
+     * The wrapped function is called through a thunk, a plain function pointer instantiated for the signature
+     * that decodes the arguments straight into the parameters of the callee and encodes its return value
+     * straight into the reply. A function given as a FunctionPointer is called directly from the thunk.
      *
      * NOTE: This class is having template constructor which takes function name and function pointer as arguments.
      * there will not be any implementations written for these templates in the library so that we need to
@@ -20,28 +71,102 @@ namespace IPC {
     class Function {
     public:
         template <typename Ret, typename... Args>
-        Function(std::string name, std::function<Ret(Args...)> func) {
-            /**
-             * Creates an anonymous function that takes a vector of std::any arguments
-             * and calls the function with the arguments unpacked from the vector.
-             */
-            function_ = [func](const std::vector<std::any>& args) -> std::any {
-                if (args.size() != sizeof...(Args)) throw std::runtime_error("Incorrect argument count");
-                auto tuple_args = vector_to_tuple<Args...>(args);
-                return std::apply(func, tuple_args);
+        Function(std::string name, std::function<Ret(Args...)> func, FunctionOptions options = {}) {
+            using Target = std::function<Ret(Args...)>;
+            target_ = std::make_shared<Target>(std::move(func));
+            thunk_ = [](const void* target, BufferReader& args, ReplyBuffer& reply) {
+                invokeDecoded<Ret, Args...>(*(const Target*)target, args, reply);
                 };
 
-            name_ = name;
-            return_type_ = typeid(Ret).name();
-            arg_types_ = { typeid(Args).name()... };
+            init<Ret, Args...>(name, options);
         }
 
+        /**
+         * Wraps a function known at compile time, the thunk calls it without any indirection.
+         */
+        template <auto Fn>
+        Function(std::string name, FunctionPointer<Fn>, FunctionOptions options = {}) {
+            initPointer<Fn>(name, options, Fn);
+        }
 
         /**
-         * Calls the function with the arguments unpacked from the vector.
+         * Wraps a streaming function, which writes any number of items to the StreamWriter before it returns.
          */
-        std::any invoke(const std::vector<std::any>& args) const {
-            return function_(args);
+        template <typename T, typename... Args>
+        Function(std::string name, std::function<void(StreamWriter<T>&, Args...)> func, FunctionOptions options = {}) {
+            using Target = std::function<void(StreamWriter<T>&, Args...)>;
+            target_ = std::make_shared<Target>(std::move(func));
+            thunk_ = [](const void* target, BufferReader& args, ReplyBuffer& reply) {
+                auto tuple_args = FunctionTraits<void(Args...)>::decodeArgs(args);
+                StreamWriter<T> writer(reply);
+                std::apply([target, &writer](auto&&... values) {
+                    (*(const Target*)target)(writer, std::forward<decltype(values)>(values)...);
+                    }, std::move(tuple_args));
+                writer.close();
+                };
+
+            if (options.cache_size > 0) {
+                throw std::runtime_error("Streaming functions cannot be cached");
+            }
+            init<Stream<T>, Args...>(name, options);
+        }
+
+        /**
+         * Calls the function with the arguments decoded from the args buffer and encodes the return value
+         * into the reply buffer. A cached function answers from its result cache if it can.
+         *
+         * [cache_hit] If set, receives whether the return value was taken from the result cache.
+         */
+        void invoke(BufferReader& args, ReplyBuffer& reply, bool* cache_hit = nullptr) const {
+            if (!cache_) {
+                thunk_(target_.get(), args, reply);
+                return;
+            }
+
+            /// The encoded arguments are the key, they stay untouched in the request while the function runs
+            BufferReader key_reader = args;
+            size_t key_size = key_reader.remaining();
+            std::string_view key(key_reader.read(key_size), key_size);
+
+            bool hit = cache_->find(key, [&reply](std::string_view result) {
+                BufferWriter writer = reply.reserve(result.size());
+                writer.write(result.data(), result.size());
+                });
+            if (cache_hit != nullptr) {
+                *cache_hit = hit;
+            }
+            if (hit) {
+                return;
+            }
+
+            CapturedReply captured;
+            thunk_(target_.get(), args, captured);
+            cache_->insert(key, captured.getData());
+
+            BufferWriter writer = reply.reserve(captured.getData().size());
+            writer.write(captured.getData().data(), captured.getData().size());
+        }
+
+        /**
+         * Counts a call of the function as pending until finish(), returns false if FunctionOptions::max_pending
+         * calls are pending already.
+         */
+        bool admit() const {
+            if (options_.max_pending == 0) {
+                return true;
+            }
+            if (pending_.fetch_add(1, std::memory_order_relaxed) >= options_.max_pending) {
+                pending_.fetch_sub(1, std::memory_order_relaxed);
+                return false;
+            }
+            return true;
+        }
+
+        /// Ends a call counted by admit().
+        void finish() const {
+            if (options_.max_pending != 0) {
+                pending_.fetch_sub(1, std::memory_order_relaxed);
+            }
         }
 
         /**
@@ -56,6 +181,13 @@ namespace IPC {
             std::cout << ")" << std::endl;
         }
 
+        /**
+         * Returns the name of the function.
+         */
+        const std::string& getName() const {
+            return name_;
+        }
+
         /**
          * Returns the number of arguments for the function.
          */
@@ -63,6 +195,34 @@ namespace IPC {
             return arg_types_.size();
         }
 
+        /**
+         * Returns the SchemaHash of the function signature.
+         */
+        uint64_t getSchemaHash() const {
+            return schema_hash_;
+        }
+
+        /**
+         * Returns true for a streaming function, see FunctionRegistry::registerStream().
+         */
+        bool isStream() const {
+            return stream_;
+        }
+
+        /**
+         * Returns the options the function is registered with.
+         */
+        const FunctionOptions& getOptions() const {
+            return options_;
+        }
+
+        /**
+         * Returns the result cache of the function, nullptr if its results are not cached.
+         */
+        const ResultCache* getCache() const {
+            return cache_.get();
+        }
+
         /**
          * Returns the argument type at the given index.
          */
@@ -71,28 +231,102 @@ namespace IPC {
             return arg_types_[index];
         }
     private:
-        template <typename... Args, std::size_t... I>
-        static auto vector_to_tuple_helper(const std::vector<std::any>& vec, std::index_sequence<I...>) {
-            return std::make_tuple(std::any_cast<Args>(vec[I])...);
+        /**
+         * Collects the encoded return value of a cached function, so that it can be cached before it is
+         * copied into the reply.
+         */
+        class CapturedReply : public ReplyBuffer {
+        public:
+            BufferWriter reserve(size_t size) override {
+                data_.resize(size);
+                return BufferWriter(data_.data(), size);
+            }
+
+            std::string_view getData() const {
+                return data_;
+            }
+
+        private:
+            std::string data_;
+        };
+
+        /**
+         * Type erased caller of the wrapped function, target is the wrapped callable (nullptr for a
+         * FunctionPointer).
+         */
+        using Thunk = void (*)(const void* target, BufferReader& args, ReplyBuffer& reply);
+
+        /**
+         * Decodes the arguments, calls the function with them and encodes the return value into the reply.
+         * The encoded size is known before the return value is written, so it is written only once.
+         */
+        template <typename Ret, typename... Args, typename Callable>
+        static void invokeDecoded(const Callable& func, BufferReader& args, ReplyBuffer& reply) {
+            auto tuple_args = FunctionTraits<Ret(Args...)>::decodeArgs(args);
+            if constexpr (std::is_void_v<Ret>) {
+                std::apply(func, std::move(tuple_args));
+                reply.reserve(0);
+            }
+            else {
+                Ret ret = std::apply(func, std::move(tuple_args));
+                BufferWriter writer = reply.reserve(Codec<std::decay_t<Ret>>::size(ret));
+                Codec<std::decay_t<Ret>>::encode(writer, ret);
+            }
         }
 
-        template <typename... Args>
-        static auto vector_to_tuple(const std::vector<std::any>& vec) {
-            if (vec.size() != sizeof...(Args)) throw std::runtime_error("Argument count mismatch");
-            return vector_to_tuple_helper<Args...>(vec, std::index_sequence_for<Args...>{});
+        /// Deduces the signature of a FunctionPointer from the pointer itself, noexcept functions included.
+        template <auto Fn, typename Ret, typename... Args>
+        void initPointer(std::string name, FunctionOptions options, Ret (*)(Args...)) {
+            thunk_ = [](const void*, BufferReader& args, ReplyBuffer& reply) {
+                invokeDecoded<Ret, Args...>(Fn, args, reply);
+                };
+
+            init<Ret, Args...>(name, options);
+        }
+
+        /// Sets the description of the signature, the return type of a schema may be a tag like Stream<T>.
+        template <typename Ret, typename... Args>
+        void init(std::string name, FunctionOptions options) {
+            name_ = name;
+            options_ = options;
+            return_type_ = typeid(Ret).name();
+            arg_types_ = { typeid(Args).name()... };
+            schema_hash_ = FunctionTraits<Ret(Args...)>::schemaHash();
+            stream_ = is_stream_v<Ret>;
+
+            if (options.cache_size > 0) {
+                cache_ = std::make_unique<ResultCache>(options.cache_size, options.cache_ttl_ms);
+            }
         }
 
-    private:
         /// Name of the function.
         std::string name_;
 
-        /// The wrapped function.
-        std::function<std::any(const std::vector<std::any>&)> function_;
+        /// Caller of the wrapped function.
+        Thunk thunk_;
+
+        /// The wrapped callable, owned by the function.
+        std::shared_ptr<const void> target_;
 
         /// Return type of the function.
         std::string return_type_;
 
         /// Argument types of the function.
         std::vector<std::string> arg_types_;
+
+        /// SchemaHash of the signature, published in the method table.
+        uint64_t schema_hash_;
+
+        /// True for a streaming function, which cannot be called in a batch.
+        bool stream_ = false;
+
+        /// Options the function is registered with.
+        FunctionOptions options_;
+
+        /// Number of admitted calls that did not finish, only counted if FunctionOptions::max_pending is set.
+        mutable std::atomic<uint32_t> pending_{ 0 };
+
+        /// Cached return values by encoded arguments, only set if FunctionOptions::cache_size is set.
+        std::unique_ptr<ResultCache> cache_;
     };
 }
\ No newline at end of file
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace IPC {
+    /**
+     * Hit and miss counters of a result cache.
+     */
+    struct CacheStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+
+    /**
+     * Bounded cache of the encoded return values of a pure function, keyed by its encoded arguments.
+     *
+     * The least recently used result is evicted once the cache holds capacity results, a result older than
+     * the TTL is treated as a miss and replaced by the next insert. Safe to share between threads.
+     */
+    class ResultCache {
+    public:
+        /**
+         * [capacity] Maximum number of cached results, must be at least 1.
+         * [ttl_ms] How long a result stays valid, -1 forever.
+         */
+        ResultCache(size_t capacity, int64_t ttl_ms) : capacity_(capacity), ttl_ms_(ttl_ms) {}
+
+        ResultCache(const ResultCache&) = delete;
+        ResultCache& operator=(const ResultCache&) = delete;
+
+        /**
+         * Calls visit with the cached result of the key while the cache is locked, so the result is copied
+         * only once. Returns false on a miss.
+         */
+        template <typename Visitor>
+        bool find(std::string_view key, Visitor visit) {
+            std::lock_guard<std::mutex> lock(mtx_);
+            auto entry = index_.find(key);
+            if (entry == index_.end() || isExpired(*entry->second)) {
+                misses_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            /// Most recently used results are kept at the front
+            entries_.splice(entries_.begin(), entries_, entry->second);
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            visit(std::string_view(entry->second->result));
+            return true;
+        }
+
+        /// Caches the result of the key, replaces an expired result and evicts the least recently used one.
+        void insert(std::string_view key, std::string_view result) {
+            std::lock_guard<std::mutex> lock(mtx_);
+            auto now = std::chrono::steady_clock::now();
+
+            auto entry = index_.find(key);
+            if (entry != index_.end()) {
+                entry->second->result.assign(result);
+                entry->second->created = now;
+                entries_.splice(entries_.begin(), entries_, entry->second);
+                return;
+            }
+
+            if (entries_.size() >= capacity_) {
+                index_.erase(entries_.back().key);
+                entries_.pop_back();
+            }
+
+            entries_.push_front(Entry{ std::string(key), std::string(result), now });
+            index_.emplace(entries_.front().key, entries_.begin());
+        }
+
+        /// Number of lookups that found a valid result.
+        uint64_t getHits() const {
+            return hits_.load(std::memory_order_relaxed);
+        }
+
+        /// Number of lookups that found no result or an expired one.
+        uint64_t getMisses() const {
+            return misses_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Entry {
+            std::string key;
+            std::string result;
+            std::chrono::steady_clock::time_point created;
+        };
+
+        bool isExpired(const Entry& entry) const {
+            return ttl_ms_ >= 0 && std::chrono::steady_clock::now() - entry.created >= std::chrono::milliseconds(ttl_ms_);
+        }
+
+        const size_t capacity_;
+        const int64_t ttl_ms_;
+
+        /// Cached results, the most recently used one first.
+        std::list<Entry> entries_;
+
+        /// Entries by key, the keys view the key of their entry.
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index_;
+
+        std::atomic<uint64_t> hits_{ 0 };
+        std::atomic<uint64_t> misses_{ 0 };
+        std::mutex mtx_;
+    };
+}
@@ -0,0 +1,494 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <vector>
+
+#include <shm_manager/shm_pool.h>
+#include <shm_manager/shm_ring.h>
+
+/// Size of a single request/response slot in the channel arena, the smallest size class (rounded up to a power of two).
+#ifndef FUNCTION_CALL_SLOT_SIZE
+#define FUNCTION_CALL_SLOT_SIZE 4096
+#endif
+
+/// Number of request/response slots in the channel arena, this is also the number of small calls that can be in flight.
+#ifndef FUNCTION_CALL_SLOT_COUNT
+#define FUNCTION_CALL_SLOT_COUNT 64
+#endif
+
+/// Size of a large slot, the largest size class (rounded up to a power of two). A request or a return value must fit into it.
+#ifndef FUNCTION_CALL_LARGE_SLOT_SIZE
+#define FUNCTION_CALL_LARGE_SLOT_SIZE (8 * 1024 * 1024)
+#endif
+
+/// Minimum number of slots of every size class, the number of slots of the largest one.
+#ifndef FUNCTION_CALL_LARGE_SLOT_COUNT
+#define FUNCTION_CALL_LARGE_SLOT_COUNT 4
+#endif
+
+/// Default of ChannelOptions::memory_cap, the number of bytes of call slots that can be in use at once.
+#ifndef FUNCTION_CALL_MEMORY_CAP
+#define FUNCTION_CALL_MEMORY_CAP (16 * 1024 * 1024)
+#endif
+
+/// Call slots of at least this size give their pages back to the system when they are released.
+#ifndef FUNCTION_CALL_TRIM_SIZE
+#define FUNCTION_CALL_TRIM_SIZE (1024 * 1024)
+#endif
+
+/// Size of the method table that maps the registered function names to their method IDs.
+#ifndef FUNCTION_METHOD_TABLE_SIZE
+#define FUNCTION_METHOD_TABLE_SIZE 16384
+#endif
+
+/// Maximum number of lanes of a channel, see ChannelOptions::lane_count. Every lane takes a submission ring.
+#ifndef FUNCTION_CHANNEL_MAX_LANES
+#define FUNCTION_CHANNEL_MAX_LANES 16
+#endif
+
+/// Default number of polls before a waiter parks on its futex, see ChannelOptions::spin_count.
+#ifndef FUNCTION_CALL_SPIN_COUNT
+#define FUNCTION_CALL_SPIN_COUNT 1024
+#endif
+
+namespace IPC {
+    /**
+     * Priority class of a call. The registry runs the queued calls of a higher class first, so a critical call
+     * does not wait behind the queued calls of a bulk job.
+     */
+    enum class CallPriority : uint16_t {
+        CRITICAL = 0,
+        NORMAL = 1,
+        BULK = 2,
+    };
+
+    /**
+     * Per-call options, given to FunctionInvoker::resolve() and applied to every call of the resolved Method.
+     */
+    struct CallOptions {
+        /// Uses ChannelOptions::call_timeout_ms as the timeout of the call.
+        static constexpr int64_t CHANNEL_TIMEOUT = -2;
+
+        CallPriority priority = CallPriority::NORMAL;
+
+        /**
+         * How long the call may take, -1 waits forever. The registry does not run a call whose timeout expired
+         * while it was queued, the call throws instead.
+         */
+        int64_t timeout_ms = CHANNEL_TIMEOUT;
+    };
+
+    /**
+     * Per-process options of a channel, given to the FunctionRegistry or the FunctionInvoker.
+     */
+    struct ChannelOptions {
+        /// Invoker lane selection: the lane of the CPU the calling thread runs on.
+        static constexpr int LANE_BY_CPU = -1;
+
+        /// Invoker lane selection: a lane picked by hashing the ID of the calling thread.
+        static constexpr int LANE_BY_THREAD = -2;
+
+        /**
+         * Maximum number of times a waiter polls (with a CPU pause hint) before parking on its futex. Spinning
+         * avoids the syscalls of a futex wait and wake when the other side answers quickly, the budget actually
+         * used shrinks while spinning does not pay off. 0 parks immediately.
+         */
+        uint32_t spin_count = FUNCTION_CALL_SPIN_COUNT;
+
+        /**
+         * Registry only. Number of worker threads that run the registered functions. 0 runs them on the thread
+         * that calls listen(), one call at a time.
+         */
+        size_t worker_count = 0;
+
+        /**
+         * Registry only. Number of lanes of the channel (1 to FUNCTION_CHANNEL_MAX_LANES). Every lane has its own
+         * submission ring, doorbell and listener thread, so invokers on different lanes do not touch the same
+         * cache lines. Lane 0 is served by the thread that calls listen(), the others by threads of their own.
+         */
+        size_t lane_count = 1;
+
+        /**
+         * Registry only. Pins the listener of lane i to CPU i (modulo the number of CPUs), so that the lanes
+         * line up with the CPUs invokers pick them by.
+         */
+        bool pin_lanes = false;
+
+        /**
+         * Invoker only. Lane the calls are submitted to: LANE_BY_CPU, LANE_BY_THREAD or a fixed lane number,
+         * which is taken modulo the lane count of the channel.
+         */
+        int lane = LANE_BY_CPU;
+
+        /**
+         * Invoker only. How long the invoker waits for the registry to create the channel and to start listening,
+         * -1 waits forever. The invoker sleeps while it waits.
+         */
+        int64_t connect_timeout_ms = -1;
+
+        /**
+         * Invoker only. How long a call may take from its submission until the response arrives, -1 waits
+         * forever. A call that times out throws and leaves its slot to the registry, which releases it once the
+         * function returns, or skips it if the call is still queued. Calls always fail once the registry process
+         * is gone, whatever the timeout. CallOptions::timeout_ms overrides it for a resolved Method.
+         */
+        int64_t call_timeout_ms = -1;
+
+        /**
+         * Registry only. Maximum number of calls taken from the submission rings that wait for a dispatch thread,
+         * 0 for no limit. Further calls are not queued but rejected as busy right away, except CRITICAL calls,
+         * so the registry sheds load instead of letting the queue and the latency grow without bound.
+         * FunctionOptions::max_pending limits the calls of a single function.
+         */
+        size_t max_queue_depth = 0;
+
+        /**
+         * Invoker only. How often a call rejected as busy (see max_queue_depth) is submitted again before it
+         * throws ServerBusyError, within its timeout.
+         */
+        uint32_t busy_retry_count = 3;
+
+        /**
+         * Invoker only. Wait before the first retry of a busy call, doubled for every further retry and
+         * randomized by up to half, so that rejected invokers do not retry in lockstep.
+         */
+        int64_t busy_backoff_us = 100;
+
+        /**
+         * Registry only. Number of bytes of call slots all invokers of the channel can hold at once. An invoker
+         * that would exceed it waits until other calls release their slots, within its call timeout. Return
+         * values that do not fit into their call slot are placed even above the cap, so that a call never fails
+         * because of it. At least one slot of the largest size class always fits.
+         */
+        size_t memory_cap = FUNCTION_CALL_MEMORY_CAP;
+
+        /**
+         * Placement of the channel shared memory in this process (huge pages, prefaulting, mlock, NUMA node).
+         * huge_pages must be the same on both sides of the channel.
+         */
+        SharedMemoryOptions memory;
+    };
+
+    /**
+     * Layout of the channel shared memory that is mapped once by the registry and every invoker.
+     *
+     * CHANNEL SHARED MEMORY STRUCTURE DETAILS
+     * 1. Channel header (ChannelHeader, one cache line)
+     * 2. Lane headers (FUNCTION_CHANNEL_MAX_LANES x LaneHeader, one cache line each)
+     * 3. Method table (FUNCTION_METHOD_TABLE_SIZE bytes)
+     * 4. Submission rings holding the offsets of the submitted call slots (FUNCTION_CHANNEL_MAX_LANES x
+     *    SharedMemoryRing, one per lane)
+     * 5. Call slot pool (SharedMemoryPool), power of two size classes from FUNCTION_CALL_SLOT_SIZE
+     *    (FUNCTION_CALL_SLOT_COUNT slots) to FUNCTION_CALL_LARGE_SLOT_SIZE, every class has half the slots of the
+     *    previous one and at least FUNCTION_CALL_LARGE_SLOT_COUNT, but no more than fit into the memory cap
+     *
+     * The size of the pool depends on the memory cap of the registry, which it publishes in the channel header.
+     * Populating or locking the segment only covers the parts before the pool and the first memory cap bytes of
+     * the pool, which hold the small slots.
+     *
+     * The method table is written once by the registry when it is sealed, before it starts listening:
+     * 1. MethodTableHeader
+     * 2. Entry of the function with method ID 0 (MethodTableEntry)
+     * 3. Entry of the function with method ID 1
+     * ...
+     * Invokers read it once when they connect, every call then carries the method ID instead of the name.
+     * An invoker checks the schema hash of a function before it calls it, so client and registry builds that
+     * disagree on a signature fail without a call being sent.
+     *
+     * Every lane listener of the registry parks on the doorbell of its lane header and every call slot has its
+     * own completion word (SlotHeader::state), so a wakeup only ever reaches the thread that waits for it. Only
+     * the slots awaited by coroutines (SLOT_NOTIFY) also bump the completion word of the channel header, which
+     * the completion threads of the invokers park on, see CompletionQueue.
+     * The call slot pool is shared by all lanes, a slot is submitted to the ring of the lane the invoker picks.
+     *
+     * A slot is taken by the invoker for the whole call, it starts with a SlotHeader (48 bytes, ending with
+     * the 16 byte FrameHeader of the request) followed by the encoded arguments. Fixed size arguments are
+     * packed without lengths, variable size ones are prefixed by a varint length, so a small call and its
+     * return value fit into the first cache line of the slot.
+     * The registry writes the encoded return value after the request when it fits into the rest of the slot,
+     * otherwise into a separate block taken from the pool. The request stays untouched while the function
+     * runs, so arguments can be handed to it as views into the slot.
+     *
+     * The registry holds the owner lock of the channel shared memory (SharedMemoryManager::isOwnerAlive())
+     * while it runs, so invokers notice a crashed registry instead of waiting forever. A restarted registry
+     * replaces the channel with a new segment, the calls in flight on the old one fail and invokers reconnect.
+     */
+    namespace Channel {
+        constexpr size_t CACHE_LINE_SIZE = 64;
+
+        /// Version of the channel layout and the call encoding, bumped on every incompatible change.
+        constexpr uint32_t WIRE_VERSION = 10;
+
+        struct alignas(CACHE_LINE_SIZE) ChannelHeader {
+            /// WIRE_VERSION of the registry, invokers of another version refuse to connect.
+            uint32_t version;
+
+            /// Number of lanes the registry serves, written before the method table is sealed.
+            uint32_t lane_count;
+
+            /// ChannelOptions::memory_cap of the registry, the size classes of the call slot pool depend on it.
+            uint64_t memory_cap;
+
+            /// Client ID handed to the next invoker that connects, see getRequestId().
+            std::atomic<uint32_t> next_client_id;
+
+            /// Futex word bumped by the registry whenever it completes a slot flagged SLOT_NOTIFY.
+            std::atomic<uint32_t> completions;
+        };
+
+        struct alignas(CACHE_LINE_SIZE) LaneHeader {
+            /// Futex word the lane listener parks on, bumped by an invoker to wake it.
+            std::atomic<uint32_t> doorbell;
+
+            /// Non-zero while the lane listener is about to park on the doorbell.
+            std::atomic<uint32_t> server_waiting;
+        };
+
+        struct MethodTableHeader {
+            /// Futex word, 0 until the registry has written the table.
+            std::atomic<uint32_t> sealed;
+
+            /// Number of registered functions, the method IDs are 0 to method_count - 1.
+            uint32_t method_count;
+
+            /// Size of the entries following the header.
+            uint64_t data_size;
+        };
+
+        /**
+         * Entry of a function in the method table, encoded with the codecs of its fields in this order.
+         */
+        struct MethodTableEntry {
+            std::string name;
+            uint64_t schema_hash;
+
+            /// Number of results invokers cache in process, 0 if they do not cache the function.
+            uint64_t client_cache_size;
+
+            /// How long a result cached by an invoker stays valid, -1 forever.
+            int64_t cache_ttl_ms;
+        };
+
+        enum SlotState : uint32_t {
+            SLOT_SUBMITTED = 1,
+            SLOT_COMPLETED = 2,
+
+            /// Set on a submitted slot by an invoker that parks on the completion word.
+            SLOT_WAITING = 4,
+
+            /// Set on a submitted slot by an invoker that gave up on the call, the registry releases the slot.
+            SLOT_ABANDONED = 8,
+
+            /// Set while the reply area holds a chunk of stream items the invoker has not taken yet.
+            SLOT_ITEMS = 16,
+
+            /// Set by a streaming function that parks on the completion word until the invoker takes its chunk.
+            SLOT_SERVER_WAITING = 32,
+
+            /// Set on a submitted slot awaited by a coroutine, its completion bumps ChannelHeader::completions.
+            SLOT_NOTIFY = 64,
+        };
+
+        enum SlotFlags : uint16_t {
+            /// The slot holds a batch of calls that are completed together, see FunctionInvoker::invokeBatch().
+            SLOT_BATCH = 1,
+
+            /// Bits holding the CallPriority of the request.
+            SLOT_PRIORITY_MASK = 0x300,
+        };
+
+        constexpr unsigned SLOT_PRIORITY_SHIFT = 8;
+
+        /// Number of priority classes, the registry keeps a queue per class.
+        constexpr size_t PRIORITY_COUNT = 3;
+
+        /**
+         * Priority bits of the SlotFlags of a request. NORMAL is encoded as 0, so a request whose flags leave the
+         * priority out is a NORMAL one, followed by BULK and CRITICAL.
+         */
+        inline uint16_t getPriorityFlags(CallPriority priority) {
+            uint16_t encoded = ((uint16_t)priority + PRIORITY_COUNT - (uint16_t)CallPriority::NORMAL) % PRIORITY_COUNT;
+            return (uint16_t)(encoded << SLOT_PRIORITY_SHIFT) & SLOT_PRIORITY_MASK;
+        }
+
+        /// Priority class (the CallPriority value) of a request, an unknown encoding counts as the lowest class.
+        inline size_t getPriority(uint16_t flags) {
+            size_t encoded = (flags & SLOT_PRIORITY_MASK) >> SLOT_PRIORITY_SHIFT;
+            if (encoded >= PRIORITY_COUNT) {
+                return PRIORITY_COUNT - 1;
+            }
+            return (encoded + (size_t)CallPriority::NORMAL) % PRIORITY_COUNT;
+        }
+
+        /**
+         * Fixed header of a request, written by the invoker.
+         */
+        struct FrameHeader {
+            /// Method ID of the called function, unused for a batch.
+            uint16_t method_id;
+
+            /// SlotFlags of the request.
+            uint16_t flags;
+
+            /// Size of the encoded arguments following the slot header.
+            uint32_t payload_size;
+
+            /// ID of the request, unique in the channel (see getRequestId()), the invoker correlates the response
+            /// with its request by it.
+            uint64_t request_id;
+        };
+
+        struct SlotHeader {
+            /// Completion word of the call (SlotState).
+            std::atomic<uint32_t> state;
+
+            /// Size of the encoded return value, or one of the RETURN_ markers below.
+            uint32_t reply_size;
+
+            /// Segment offset of the encoded return value.
+            uint64_t reply_offset;
+
+            /// Segment offset of the pool block holding the return value, 0 if it is inside the slot.
+            uint64_t reply_block;
+
+            /// Deadline of the call in steady clock (CLOCK_MONOTONIC) nanoseconds, which all processes share,
+            /// 0 if the call has none. The registry skips a call whose deadline passed while it was queued.
+            uint64_t deadline_ns;
+
+            FrameHeader frame;
+        };
+
+        static_assert(sizeof(FrameHeader) == 16, "The frame header must stay 16 bytes");
+        static_assert(sizeof(SlotHeader) == 48, "The slot header must leave room for a small call in a cache line");
+
+        constexpr size_t SLOT_SIZE = FUNCTION_CALL_SLOT_SIZE;
+        constexpr size_t SLOT_COUNT = FUNCTION_CALL_SLOT_COUNT;
+        constexpr size_t LARGE_SLOT_SIZE = FUNCTION_CALL_LARGE_SLOT_SIZE;
+        constexpr size_t LARGE_SLOT_COUNT = FUNCTION_CALL_LARGE_SLOT_COUNT;
+
+        constexpr size_t MAX_LANES = FUNCTION_CHANNEL_MAX_LANES;
+
+        static_assert(MAX_LANES > 0, "A channel needs at least one lane");
+
+        /// Number of slots of all size classes of the call slot pool, see getSlotClasses().
+        constexpr size_t getTotalSlotCount() {
+            size_t count = 0;
+            size_t size_class = 0;
+            for (size_t size = std::bit_ceil(SLOT_SIZE); size <= std::bit_ceil(LARGE_SLOT_SIZE); size *= 2) {
+                count += std::max(LARGE_SLOT_COUNT, SLOT_COUNT >> size_class++);
+            }
+            return count;
+        }
+
+        /// Every slot can be queued at once on any lane, so a ring of this capacity never fills up.
+        constexpr size_t RING_CAPACITY = std::bit_ceil(getTotalSlotCount());
+
+        /// Marks a response whose return value did not fit into any buffer.
+        constexpr uint32_t RETURN_OVERFLOW = UINT32_MAX;
+
+        /// Marks the response of a call the registry did not run because its deadline passed while it was queued.
+        constexpr uint32_t RETURN_EXPIRED = UINT32_MAX - 1;
+
+        /// Marks the response of a call the registry rejected because too many calls were queued, the request is
+        /// left untouched so that the invoker can submit the slot again.
+        constexpr uint32_t RETURN_BUSY = UINT32_MAX - 2;
+
+        /// Marks the response of a call that failed in the registry (the function threw or the call could not be
+        /// decoded). reply_offset points at the error message, encoded as a std::string, or is 0 without one.
+        constexpr uint32_t RETURN_ERROR = UINT32_MAX - 3;
+
+        /// Reads the steady clock as a deadline of the slot header.
+        inline uint64_t getDeadlineNs(std::chrono::steady_clock::time_point time) {
+            if (time == std::chrono::steady_clock::time_point::max()) {
+                return 0;
+            }
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+        }
+
+        /// Number of low bits of a request ID that hold the per-invoker request counter.
+        constexpr unsigned REQUEST_COUNTER_BITS = 40;
+
+        /**
+         * Builds a request ID from the client ID the invoker got when it connected and its request counter,
+         * so request IDs are unique in the channel without any state shared between invokers.
+         */
+        inline uint64_t getRequestId(uint32_t client_id, uint64_t counter) {
+            return ((uint64_t)client_id << REQUEST_COUNTER_BITS) | (counter & ((1ull << REQUEST_COUNTER_BITS) - 1));
+        }
+
+        /// Method IDs are carried as uint16_t.
+        constexpr size_t MAX_METHOD_COUNT = UINT16_MAX + 1;
+
+        static_assert(SLOT_SIZE > sizeof(SlotHeader), "Function call slot is too small");
+        static_assert(LARGE_SLOT_SIZE > SLOT_SIZE, "Large function call slots must be larger than regular slots");
+        static_assert(LARGE_SLOT_SIZE < RETURN_OVERFLOW, "Payload and reply sizes must fit into 32 bits");
+
+        /**
+         * Size classes of the call slot pool. A class has no more slots than fit into the memory cap, the ones
+         * above it could never be taken at once, but at least one.
+         */
+        inline std::vector<SharedMemoryPool::SizeClass> getSlotClasses(size_t memory_cap) {
+            std::vector<SharedMemoryPool::SizeClass> size_classes =
+                SharedMemoryPool::powerOfTwoClasses(SLOT_SIZE, LARGE_SLOT_SIZE, SLOT_COUNT, LARGE_SLOT_COUNT);
+            for (SharedMemoryPool::SizeClass& size_class : size_classes) {
+                size_class.block_count = std::min(size_class.block_count,
+                    std::max<size_t>(1, memory_cap / size_class.block_size));
+            }
+            return size_classes;
+        }
+
+        /**
+         * Limits of the call slot pool, written by the registry. Prefaulted or locked memory keeps its pages,
+         * so slots are only trimmed without those options.
+         */
+        inline SharedMemoryPool::Limits getPoolLimits(const ChannelOptions& options) {
+            bool keep_pages = options.memory.populate || options.memory.lock;
+            return { options.memory_cap, keep_pages ? SIZE_MAX : (size_t)FUNCTION_CALL_TRIM_SIZE };
+        }
+
+        /// Offset of the first byte after the request in a slot, the return value is placed from there.
+        inline size_t getReplyOffset(const SlotHeader* slot) {
+            return (sizeof(SlotHeader) + slot->frame.payload_size + alignof(std::max_align_t) - 1)
+                / alignof(std::max_align_t) * alignof(std::max_align_t);
+        }
+
+        constexpr size_t METHOD_TABLE_SIZE = FUNCTION_METHOD_TABLE_SIZE;
+
+        static_assert(METHOD_TABLE_SIZE % CACHE_LINE_SIZE == 0, "Method table size must be a multiple of 64");
+        static_assert(METHOD_TABLE_SIZE > sizeof(MethodTableHeader), "Method table is too small");
+
+        constexpr size_t HEADER_OFFSET = 0;
+        constexpr size_t LANES_OFFSET = sizeof(ChannelHeader);
+        constexpr size_t METHOD_TABLE_OFFSET = LANES_OFFSET + sizeof(LaneHeader) * MAX_LANES;
+        constexpr size_t RING_OFFSET = METHOD_TABLE_OFFSET + METHOD_TABLE_SIZE;
+
+        inline size_t getLaneOffset(size_t lane) {
+            return LANES_OFFSET + sizeof(LaneHeader) * lane;
+        }
+
+        inline size_t getRingOffset(size_t lane) {
+            return RING_OFFSET + SharedMemoryRing::requiredSize(RING_CAPACITY) * lane;
+        }
+
+        inline size_t getPoolOffset() {
+            return getRingOffset(MAX_LANES);
+        }
+
+        /// Total size of the channel shared memory.
+        inline size_t getShmSize(size_t memory_cap) {
+            return getPoolOffset() + SharedMemoryPool::requiredSize(getSlotClasses(memory_cap));
+        }
+
+        /// Number of bytes from the start of the channel shared memory that are populated or locked.
+        inline size_t getPrefaultSize(size_t memory_cap) {
+            return getPoolOffset() + std::min(memory_cap, SharedMemoryPool::requiredSize(getSlotClasses(memory_cap)));
+        }
+    }
+}
@@ -0,0 +1,482 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+namespace IPC {
+    /// Number of bytes writeVarint() takes for the value, 1 for values below 128.
+    inline constexpr size_t varintSize(uint64_t value) {
+        size_t size = 1;
+        while (value >= 0x80) {
+            value >>= 7;
+            size++;
+        }
+        return size;
+    }
+
+    /**
+     * Appends encoded values to a fixed size buffer, usually a call slot in the channel shared memory.
+     *
+     * Writing past the capacity does not throw, the writer remembers the overflow so that the caller can
+     * report it once everything is encoded.
+     */
+    class BufferWriter {
+    public:
+        BufferWriter(char* data, size_t capacity) : data_(data), capacity_(capacity) {}
+
+        void write(const void* value, size_t size) {
+            if (overflow_ || size > capacity_ - offset_) {
+                overflow_ = true;
+                return;
+            }
+
+            memcpy(data_ + offset_, value, size);
+            offset_ += size;
+        }
+
+        /// Writes an unsigned LEB128 varint, 7 bits per byte with the high bit set on all but the last byte.
+        void writeVarint(uint64_t value) {
+            char bytes[10];
+            size_t size = 0;
+            while (value >= 0x80) {
+                bytes[size++] = (char)(value | 0x80);
+                value >>= 7;
+            }
+            bytes[size++] = (char)value;
+            write(bytes, size);
+        }
+
+        /// Reserves the next size bytes so that the caller can fill them in place, nullptr on overflow.
+        char* reserve(size_t size) {
+            if (overflow_ || size > capacity_ - offset_) {
+                overflow_ = true;
+                return nullptr;
+            }
+
+            char* value = data_ + offset_;
+            offset_ += size;
+            return value;
+        }
+
+        /// Number of bytes written so far.
+        size_t size() const {
+            return offset_;
+        }
+
+        /// True if a write did not fit into the buffer.
+        bool overflowed() const {
+            return overflow_;
+        }
+
+    private:
+        char* data_;
+        size_t capacity_;
+        size_t offset_ = 0;
+        bool overflow_ = false;
+    };
+
+    /**
+     * Reads encoded values from a buffer, every read is bounds checked.
+     */
+    class BufferReader {
+    public:
+        BufferReader(const char* data, size_t size) : data_(data), size_(size) {}
+
+        /// Returns a pointer to the next size bytes and skips them.
+        const char* read(size_t size) {
+            if (size > size_ - offset_) {
+                throw std::runtime_error("Read past the end of the call data");
+            }
+
+            const char* value = data_ + offset_;
+            offset_ += size;
+            return value;
+        }
+
+        /// Reads a varint written by BufferWriter::writeVarint().
+        uint64_t readVarint() {
+            uint64_t value = 0;
+            for (unsigned shift = 0; shift < 64; shift += 7) {
+                uint8_t byte = (uint8_t)*read(1);
+                value |= (uint64_t)(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) {
+                    return value;
+                }
+            }
+            throw std::runtime_error("Invalid varint in the call data");
+        }
+
+        /// Number of bytes not read yet.
+        size_t remaining() const {
+            return size_ - offset_;
+        }
+
+    private:
+        const char* data_;
+        size_t size_;
+        size_t offset_ = 0;
+    };
+
+    template <typename T>
+    inline constexpr bool unsupported_type_v = false;
+
+    /**
+     * Encodes and decodes a single argument or return value. The codec of a type is picked at compile time
+     * from the function signature, so both ends agree on the layout without any type information on the wire.
+     *
+     * Every codec provides:
+     * - size(value): Number of bytes encode() writes for the value.
+     * - encode(writer, value): Appends the value to the writer.
+     * - decode(reader): Reads the value back.
+     */
+    template <typename T, typename Enable = void>
+    struct Codec {
+        static_assert(unsupported_type_v<T>, "Unsupported argument or return type");
+    };
+
+    /**
+     * Scalars (int, double, float, bool, ...) are copied as is.
+     */
+    template <typename T>
+    struct Codec<T, std::enable_if_t<std::is_arithmetic_v<T>>> {
+        static constexpr size_t size(const T&) {
+            return sizeof(T);
+        }
+
+        static void encode(BufferWriter& writer, const T& value) {
+            writer.write(&value, sizeof(T));
+        }
+
+        static T decode(BufferReader& reader) {
+            T value;
+            memcpy(&value, reader.read(sizeof(T)), sizeof(T));
+            return value;
+        }
+    };
+
+    /**
+     * Strings are encoded as their length (varint) followed by the characters.
+     *
+     * Anything convertible to a std::string_view can be passed, so string literals are encoded without
+     * constructing a std::string.
+     */
+    template <>
+    struct Codec<std::string> {
+        static size_t size(std::string_view value) {
+            return varintSize(value.size()) + value.size();
+        }
+
+        static void encode(BufferWriter& writer, std::string_view value) {
+            writer.writeVarint(value.size());
+            writer.write(value.data(), value.size());
+        }
+
+        static std::string decode(BufferReader& reader) {
+            uint64_t length = reader.readVarint();
+            return std::string(reader.read(length), length);
+        }
+    };
+
+    /**
+     * An argument the invoker fills in place in the call slot instead of copying it from another buffer,
+     * created with inPlace(). It can be passed for a std::string_view or std::span<const std::byte>
+     * parameter.
+     */
+    template <typename Fill>
+    struct InPlace {
+        size_t size;
+        Fill fill;
+    };
+
+    /**
+     * Reserves size bytes for an argument in the call slot, fill is called with a writable span over them.
+     *
+     * invoker.call<void(std::span<const std::byte>)>("store", IPC::inPlace(size, [](std::span<std::byte> out) {
+     *     ...
+     * }));
+     */
+    template <typename Fill>
+    InPlace<Fill> inPlace(size_t size, Fill fill) {
+        return InPlace<Fill>{ size, fill };
+    }
+
+    /**
+     * Views (std::string_view, std::span<const std::byte>) are encoded like strings, but decoded without a
+     * copy, the decoded view points into the call slot. On the registry side they are valid until the function
+     * returns, on the invoker side they are returned inside a Reply that holds the call slot.
+     */
+    template <typename View, typename Byte>
+    struct ViewCodec {
+        static size_t size(const View& value) {
+            return varintSize(value.size()) + value.size() * sizeof(typename View::value_type);
+        }
+
+        template <typename Fill>
+        static size_t size(const InPlace<Fill>& value) {
+            return varintSize(value.size) + value.size;
+        }
+
+        static void encode(BufferWriter& writer, const View& value) {
+            writer.writeVarint(value.size());
+            writer.write(value.data(), value.size());
+        }
+
+        template <typename Fill>
+        static void encode(BufferWriter& writer, const InPlace<Fill>& value) {
+            writer.writeVarint(value.size);
+
+            char* data = writer.reserve(value.size);
+            if (data != nullptr) {
+                value.fill(std::span<Byte>((Byte*)data, value.size));
+            }
+        }
+
+        static View decode(BufferReader& reader) {
+            uint64_t length = reader.readVarint();
+            return View((const typename View::value_type*)reader.read(length), length);
+        }
+    };
+
+    template <>
+    struct Codec<std::string_view> : ViewCodec<std::string_view, char> {};
+
+    template <>
+    struct Codec<std::span<const std::byte>> : ViewCodec<std::span<const std::byte>, std::byte> {};
+
+    /**
+     * True for the types whose decoded value points into the call slot.
+     */
+    template <typename T>
+    inline constexpr bool is_view_v = std::is_same_v<T, std::string_view> || std::is_same_v<T, std::span<const std::byte>>;
+
+    /**
+     * True for every std::span and std::basic_string_view, which are trivially copyable but only hold a pointer.
+     * Only the views of is_view_v have a codec.
+     */
+    template <typename T>
+    inline constexpr bool is_pointer_view_v = false;
+
+    template <typename T, size_t Extent>
+    inline constexpr bool is_pointer_view_v<std::span<T, Extent>> = true;
+
+    template <typename Char, typename Traits>
+    inline constexpr bool is_pointer_view_v<std::basic_string_view<Char, Traits>> = true;
+
+    template <typename T>
+    struct Codec<T, std::enable_if_t<is_pointer_view_v<T> && !is_view_v<T>>> {
+        static_assert(unsupported_type_v<T>,
+            "Only std::string_view and std::span<const std::byte> can be passed as views, use a std::vector or std::string");
+    };
+
+    /**
+     * True for the non-scalar types that are copied as a single block: trivially copyable structs, std::array
+     * and enums. Raw pointers, member pointers, spans and string views are excluded. A struct with a pointer
+     * member is NOT detected: it is copied as is, and the pointer is meaningless in the other process.
+     */
+    template <typename T>
+    inline constexpr bool is_block_v = std::is_trivially_copyable_v<T> && std::is_default_constructible_v<T>
+        && !std::is_arithmetic_v<T> && !std::is_pointer_v<T> && !std::is_member_pointer_v<T> && !is_pointer_view_v<T>;
+
+    /**
+     * Trivially copyable structs, std::array of them and enums are copied as is, like scalars. Both ends must
+     * be built with the same definition of the type, its layout is not checked.
+     *
+     * struct Point { double x; double y; };
+     * invoker.call<double(Point, Point)>("distance", Point{ 0, 0 }, Point{ 3, 4 });
+     */
+    template <typename T>
+    struct Codec<T, std::enable_if_t<is_block_v<T>>> {
+        static constexpr size_t size(const T&) {
+            return sizeof(T);
+        }
+
+        static void encode(BufferWriter& writer, const T& value) {
+            writer.write(&value, sizeof(T));
+        }
+
+        static T decode(BufferReader& reader) {
+            T value;
+            memcpy(&value, reader.read(sizeof(T)), sizeof(T));
+            return value;
+        }
+    };
+
+    /**
+     * Vectors are encoded as their number of elements (varint) followed by the elements. The elements of
+     * scalar and block types are copied with a single memcpy, any other element type is encoded one element
+     * after the other by its own codec.
+     */
+    template <typename T>
+    struct Codec<std::vector<T>> {
+        /// std::vector<bool> does not store its elements contiguously.
+        static constexpr bool CONTIGUOUS = (std::is_arithmetic_v<T> || is_block_v<T>) && !std::is_same_v<T, bool>;
+
+        static size_t size(const std::vector<T>& value) {
+            if constexpr (CONTIGUOUS) {
+                return varintSize(value.size()) + sizeof(T) * value.size();
+            }
+            else {
+                size_t size = varintSize(value.size());
+                for (const T& element : value) {
+                    size += Codec<T>::size(element);
+                }
+                return size;
+            }
+        }
+
+        static void encode(BufferWriter& writer, const std::vector<T>& value) {
+            writer.writeVarint(value.size());
+
+            if constexpr (CONTIGUOUS) {
+                writer.write(value.data(), sizeof(T) * value.size());
+            }
+            else {
+                for (const T& element : value) {
+                    Codec<T>::encode(writer, element);
+                }
+            }
+        }
+
+        static std::vector<T> decode(BufferReader& reader) {
+            uint64_t length = reader.readVarint();
+
+            if constexpr (CONTIGUOUS) {
+                /// Checked before the multiplication so that a corrupt length cannot overflow it
+                if (length > reader.remaining() / sizeof(T)) {
+                    throw std::runtime_error("Read past the end of the call data");
+                }
+
+                std::vector<T> value(length);
+                memcpy(value.data(), reader.read(sizeof(T) * length), sizeof(T) * length);
+                return value;
+            }
+            else {
+                std::vector<T> value;
+                value.reserve(std::min<uint64_t>(length, reader.remaining()));
+                for (uint64_t i = 0; i < length; i++) {
+                    value.push_back(Codec<T>::decode(reader));
+                }
+                return value;
+            }
+        }
+    };
+
+    /**
+     * Receives the encoded return value of a function. The registry decides where the return value is
+     * placed once its encoded size is known.
+     */
+    class ReplyBuffer {
+    public:
+        virtual ~ReplyBuffer() = default;
+
+        /// Returns a writer over size bytes for the encoded return value, the writer overflows if no buffer fits.
+        virtual BufferWriter reserve(size_t size) = 0;
+
+        /// Largest chunk of stream items publishChunk() takes, 0 if the reply cannot stream (e.g. in a batch).
+        virtual size_t getChunkCapacity() const {
+            return 0;
+        }
+
+        /// True while the invoker has not taken the last published chunk yet.
+        virtual bool isChunkPending() const {
+            return false;
+        }
+
+        /// Blocks until the invoker has taken the last published chunk, returns false if it gave up on the call.
+        virtual bool waitChunkConsumed() {
+            return true;
+        }
+
+        /**
+         * Hands a chunk of encoded stream items to the invoker before the call completes, waits until it has
+         * taken the previous chunk. Returns false if the invoker gave up on the call.
+         */
+        virtual bool publishChunk(const char* /* data */, size_t /* size */) {
+            return false;
+        }
+
+        /**
+         * Fails the call with the given message instead of returning a value, the invoker throws it. A buffer
+         * that cannot carry the error throws it instead.
+         */
+        virtual void fail(std::string_view message) {
+            throw std::runtime_error(std::string(message));
+        }
+    };
+
+    /**
+     * Hash of a function signature, published with every function in the method table so that an invoker
+     * built against a different signature fails before it sends a single call. It is an FNV-1a hash over the
+     * type names of the return type and the decayed argument types, so it can also be built at runtime from
+     * type erased arguments.
+     */
+    class SchemaHash {
+    public:
+        void add(const std::type_info& type) {
+            for (const char* c = type.name(); *c != '\0'; c++) {
+                hash_ = (hash_ ^ (uint8_t)*c) * 0x100000001b3ull;
+            }
+
+            /// Separates the type names, so that their boundaries are part of the hash
+            hash_ = (hash_ ^ 0xff) * 0x100000001b3ull;
+        }
+
+        uint64_t value() const {
+            return hash_;
+        }
+
+    private:
+        uint64_t hash_ = 0xcbf29ce484222325ull;
+    };
+
+    /**
+     * Compile time details of a function signature, e.g. FunctionTraits<int(int, int)>.
+     */
+    template <typename Signature>
+    struct FunctionTraits;
+
+    template <typename Ret, typename... Args>
+    struct FunctionTraits<Ret(Args...)> {
+        using return_type = Ret;
+        using args_tuple = std::tuple<std::decay_t<Args>...>;
+        static constexpr size_t arity = sizeof...(Args);
+
+        /// SchemaHash of the signature, computed once.
+        static uint64_t schemaHash() {
+            static const uint64_t hash = [] {
+                SchemaHash schema;
+                schema.add(typeid(Ret));
+                (schema.add(typeid(std::decay_t<Args>)), ...);
+                return schema.value();
+            }();
+            return hash;
+        }
+
+        /// Number of bytes the encoded arguments take.
+        template <typename... CallArgs>
+        static size_t argsSize(const CallArgs&... args) {
+            return (Codec<std::decay_t<Args>>::size(args) + ... + 0);
+        }
+
+        /// Encodes the arguments in order.
+        template <typename... CallArgs>
+        static void encodeArgs(BufferWriter& writer, const CallArgs&... args) {
+            (Codec<std::decay_t<Args>>::encode(writer, args), ...);
+        }
+
+        /// Decodes the arguments in order, the braced initialization guarantees the left to right order.
+        static args_tuple decodeArgs(BufferReader& reader) {
+            return args_tuple{ Codec<std::decay_t<Args>>::decode(reader)... };
+        }
+    };
+}
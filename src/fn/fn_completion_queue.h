@@ -0,0 +1,211 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <ctime>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <fn/fn_channel.h>
+#include <sync/futex.h>
+
+namespace IPC {
+    /**
+     * Resumes the coroutines that await calls of an invoker once their calls complete.
+     *
+     * The awaited slots are flagged SLOT_NOTIFY, so the registry bumps the completion word of the channel
+     * (ChannelHeader::completions) whenever it completes one of them. A single thread parks on that word and
+     * every time it wakes up it resumes all awaiting coroutines whose calls have completed by then, in
+     * whatever order they complete, so the coroutines are resumed on this thread. The thread is started with
+     * the first awaited call.
+     *
+     * A call the registry rejected as busy is submitted again by the thread once its backoff ends, the thread
+     * keeps resuming the other calls meanwhile. Coroutines whose calls can no longer complete (the deadline
+     * passed or the registry died) are resumed as well, reading their result throws.
+     */
+    class CompletionQueue {
+    public:
+        /**
+         * Given the deadline and the busy retry counter of a call the registry rejected as busy, returns the time
+         * at which the call is submitted again and counts the retry, nullopt if the call is not retried.
+         */
+        using BusyRetryFunction = std::function<std::optional<std::chrono::steady_clock::time_point>(
+            std::chrono::steady_clock::time_point, uint32_t&)>;
+
+        /**
+         * [completions] ChannelHeader::completions of the channel.
+         * [is_alive] Returns false if the registry died.
+         * [busy_retry] See BusyRetryFunction.
+         * [resubmit] Submits a busy call again with the given slot state.
+         */
+        CompletionQueue(std::atomic<uint32_t>* completions, std::function<bool()> is_alive,
+            BusyRetryFunction busy_retry, std::function<void(Channel::SlotHeader*, uint32_t)> resubmit)
+            : state_(std::make_shared<State>()) {
+            state_->completions = completions;
+            state_->is_alive = is_alive;
+            state_->busy_retry = busy_retry;
+            state_->resubmit = resubmit;
+        }
+
+        /**
+         * Waits until the awaited calls are resumed. A coroutine resumed on the completion thread may destroy
+         * the queue, the thread is left to stop on its own then.
+         */
+        ~CompletionQueue() {
+            bool own_thread = thread_.joinable() && thread_.get_id() == std::this_thread::get_id();
+            {
+                std::lock_guard<std::mutex> lock(state_->mtx);
+                state_->stop = true;
+                state_->detached = own_thread;
+            }
+            state_->cv.notify_one();
+
+            if (own_thread) {
+                thread_.detach();
+            }
+            else if (thread_.joinable()) {
+                thread_.join();
+            }
+        }
+
+        CompletionQueue(const CompletionQueue&) = delete;
+        CompletionQueue& operator=(const CompletionQueue&) = delete;
+
+        /**
+         * Resumes the coroutine once the call in the given slot is completed or its deadline passed.
+         *
+         * [retries] Busy retry counter of the call, shared with the waits of the call outside the queue.
+         */
+        void add(Channel::SlotHeader* slot, std::chrono::steady_clock::time_point deadline, uint32_t* retries,
+            std::coroutine_handle<> handle) {
+            {
+                std::lock_guard<std::mutex> lock(state_->mtx);
+                if (!thread_.joinable()) {
+                    thread_ = std::thread(&CompletionQueue::run, state_);
+                }
+                state_->pending.push_back({ slot, deadline, retries, handle, std::nullopt });
+
+                /// Flagged under the lock, the thread cannot resume the call and release its slot meanwhile
+                uint32_t state = slot->state.load(std::memory_order_acquire);
+                while (state != Channel::SLOT_COMPLETED && !slot->state.compare_exchange_weak(state,
+                    state | Channel::SLOT_NOTIFY, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                }
+                if (state == Channel::SLOT_COMPLETED) {
+                    /// Completed before it was flagged, the thread may be parked without noticing it
+                    state_->completions->fetch_add(1, std::memory_order_release);
+                    Futex::wakeAll(state_->completions);
+                }
+            }
+            state_->cv.notify_one();
+        }
+
+    private:
+        struct PendingCall {
+            Channel::SlotHeader* slot;
+            std::chrono::steady_clock::time_point deadline;
+            uint32_t* retries;
+            std::coroutine_handle<> handle;
+
+            /// Set while the call waits for the backoff of a busy retry.
+            std::optional<std::chrono::steady_clock::time_point> retry_time;
+        };
+
+        /// Shared with the thread, which may outlive the queue, see ~CompletionQueue().
+        struct State {
+            std::atomic<uint32_t>* completions = nullptr;
+            std::function<bool()> is_alive;
+            BusyRetryFunction busy_retry;
+            std::function<void(Channel::SlotHeader*, uint32_t)> resubmit;
+
+            std::list<PendingCall> pending;
+            bool stop = false;
+            bool detached = false;
+            std::mutex mtx;
+            std::condition_variable cv;
+        };
+
+        /** Interval in which the thread checks the deadlines and the registry while it is parked. */
+        static constexpr int LIVENESS_POLL_INTERVAL_MS = 100;
+
+        static bool isCompleted(const Channel::SlotHeader* slot) {
+            return slot->state.load(std::memory_order_acquire) == Channel::SLOT_COMPLETED;
+        }
+
+        static void run(std::shared_ptr<State> state) {
+            std::vector<std::coroutine_handle<>> completed;
+            bool alive = true;
+
+            std::unique_lock<std::mutex> lock(state->mtx);
+            while (true) {
+                state->cv.wait(lock, [&state] { return state->stop || !state->pending.empty(); });
+                if (state->detached || state->pending.empty()) {
+                    return;
+                }
+
+                /// Read before the slots, a completion after the scan changes the word and ends the park
+                uint32_t completions = state->completions->load(std::memory_order_acquire);
+                auto now = std::chrono::steady_clock::now();
+                auto wake_time = now + std::chrono::milliseconds(LIVENESS_POLL_INTERVAL_MS);
+                for (auto call = state->pending.begin(); call != state->pending.end();) {
+                    if (call->retry_time) {
+                        if (now < *call->retry_time) {
+                            wake_time = std::min(wake_time, *call->retry_time);
+                            call++;
+                            continue;
+                        }
+                        call->retry_time.reset();
+                        state->resubmit(call->slot, Channel::SLOT_SUBMITTED | Channel::SLOT_NOTIFY);
+                    }
+
+                    if (isCompleted(call->slot) && call->slot->reply_size == Channel::RETURN_BUSY) {
+                        call->retry_time = state->busy_retry(call->deadline, *call->retries);
+                        if (call->retry_time) {
+                            wake_time = std::min(wake_time, *call->retry_time);
+                            call++;
+                            continue;
+                        }
+                    }
+
+                    if (!alive || isCompleted(call->slot) || now >= call->deadline) {
+                        completed.push_back(call->handle);
+                        call = state->pending.erase(call);
+                    }
+                    else {
+                        wake_time = std::min(wake_time, call->deadline);
+                        call++;
+                    }
+                }
+                alive = true;
+
+                if (completed.empty()) {
+                    lock.unlock();
+                    auto timeout = std::max<std::chrono::nanoseconds>(std::chrono::nanoseconds(0),
+                        wake_time - std::chrono::steady_clock::now());
+                    timespec wait_time = { (time_t)(timeout.count() / 1000000000), (long)(timeout.count() % 1000000000) };
+                    if (!Futex::wait(state->completions, completions, &wait_time)) {
+                        alive = state->is_alive();
+                    }
+                    lock.lock();
+                    continue;
+                }
+
+                /// Resumed without the lock, the coroutines may await further calls
+                lock.unlock();
+                for (auto handle : completed) {
+                    handle.resume();
+                }
+                completed.clear();
+                lock.lock();
+            }
+        }
+
+        std::shared_ptr<State> state_;
+        std::thread thread_;
+    };
+}
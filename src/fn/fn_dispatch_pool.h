@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fn/fn_channel.h>
+
+namespace IPC {
+    /**
+     * A pool of worker threads that run the calls taken from the submission ring by the registry.
+     *
+     * Every worker owns a queue. Submitted calls are spread over the queues round robin, a worker takes calls
+     * from the front of its own queue and steals from the back of the other queues when its own queue is
+     * empty, so one slow call only delays the calls queued behind it on the same worker until another worker
+     * becomes idle.
+     *
+     * Every queue is split by priority class. A worker takes the calls of the highest class queued anywhere
+     * first, so a critical call only waits for a worker to become idle, never for the queued calls of a lower
+     * class.
+     */
+    class DispatchPool {
+    public:
+        /**
+         * [worker_count] Number of worker threads.
+         * [handler] Called on a worker thread for every submitted call slot, with the index of the worker.
+         */
+        DispatchPool(size_t worker_count, std::function<void(size_t, uint64_t)> handler) : handler_(handler) {
+            for (size_t i = 0; i < worker_count; i++) {
+                queues_.push_back(std::make_unique<WorkerQueue>());
+            }
+            for (size_t i = 0; i < worker_count; i++) {
+                workers_.emplace_back(&DispatchPool::run, this, i);
+            }
+        }
+
+        ~DispatchPool() {
+            {
+                std::lock_guard<std::mutex> lock(idle_mtx_);
+                stop_ = true;
+            }
+            idle_cv_.notify_all();
+
+            for (auto& worker : workers_) {
+                worker.join();
+            }
+        }
+
+        DispatchPool(const DispatchPool&) = delete;
+        DispatchPool& operator=(const DispatchPool&) = delete;
+
+        /**
+         * Queues a call slot for one of the workers.
+         *
+         * [priority] Priority class of the call, below Channel::PRIORITY_COUNT.
+         */
+        void submit(uint64_t slot_offset, size_t priority) {
+            WorkerQueue& queue = *queues_[next_queue_++ % queues_.size()];
+            {
+                /// Counted before the call is visible, a worker that takes it right away must not wrap the counters
+                std::lock_guard<std::mutex> lock(queue.mtx);
+                pending_.fetch_add(1, std::memory_order_relaxed);
+                queued_[priority].fetch_add(1, std::memory_order_relaxed);
+                queue.tasks[priority].push_back(slot_offset);
+            }
+
+            /// An idle worker checks pending_ under idle_mtx_, taking it orders the wakeup after that check
+            {
+                std::lock_guard<std::mutex> lock(idle_mtx_);
+            }
+            idle_cv_.notify_one();
+        }
+
+        /// Number of submitted calls no worker took yet.
+        size_t getPendingCount() const {
+            return pending_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct alignas(64) WorkerQueue {
+            std::mutex mtx;
+            std::deque<uint64_t> tasks[Channel::PRIORITY_COUNT];
+        };
+
+        void run(size_t index) {
+            while (true) {
+                uint64_t slot_offset;
+                if (take(index, slot_offset)) {
+                    handler_(index, slot_offset);
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(idle_mtx_);
+                idle_cv_.wait(lock, [this] { return stop_ || pending_.load(std::memory_order_relaxed) > 0; });
+                if (stop_) {
+                    return;
+                }
+            }
+        }
+
+        /**
+         * Takes the oldest call of the highest priority class of the worker's own queue, or steals the newest
+         * call of that class from another queue. Lower classes are only looked at once no higher class is queued.
+         */
+        bool take(size_t index, uint64_t& slot_offset) {
+            for (size_t priority = 0; priority < Channel::PRIORITY_COUNT; priority++) {
+                if (queued_[priority].load(std::memory_order_relaxed) == 0) {
+                    continue;
+                }
+
+                for (size_t i = 0; i < queues_.size(); i++) {
+                    WorkerQueue& queue = *queues_[(index + i) % queues_.size()];
+
+                    std::lock_guard<std::mutex> lock(queue.mtx);
+                    std::deque<uint64_t>& tasks = queue.tasks[priority];
+                    if (tasks.empty()) {
+                        continue;
+                    }
+
+                    if (i == 0) {
+                        slot_offset = tasks.front();
+                        tasks.pop_front();
+                    }
+                    else {
+                        slot_offset = tasks.back();
+                        tasks.pop_back();
+                    }
+                    queued_[priority].fetch_sub(1, std::memory_order_relaxed);
+                    pending_.fetch_sub(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::function<void(size_t, uint64_t)> handler_;
+
+        std::vector<std::unique_ptr<WorkerQueue>> queues_;
+        std::vector<std::thread> workers_;
+        std::atomic<size_t> next_queue_{ 0 };
+
+        /// Number of queued calls of every priority class, lets the workers skip the empty classes.
+        std::atomic<size_t> queued_[Channel::PRIORITY_COUNT] = {};
+
+        /// Number of queued calls that no worker took yet, idle workers sleep while it is 0.
+        std::atomic<size_t> pending_{ 0 };
+        bool stop_ = false;
+        std::mutex idle_mtx_;
+        std::condition_variable idle_cv_;
+    };
+}
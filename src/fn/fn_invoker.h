@@ -1,294 +1,1436 @@
 #pragma once
 
+#include <array>
 #include <string>
 #include <any>
 #include <vector>
-#include <pthread.h>
-#include <random>
-#include <sstream>
-#include <iomanip>
 #include <typeinfo>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <stdexcept>
 
-#include <shm_manager/shm_manager.h>
+#include <sched.h>
 
-#ifndef FUNCTION_CALL_DATA_SHM_SIZE
-#define FUNCTION_CALL_DATA_SHM_SIZE 256
-#endif
+#include <fn/fn_cache.h>
+#include <fn/fn_channel.h>
+#include <fn/fn_codec.h>
+#include <fn/fn_completion_queue.h>
+#include <fn/fn_stream.h>
+#include <shm_manager/shm_manager.h>
+#include <shm_manager/shm_pool.h>
+#include <shm_manager/shm_ring.h>
+#include <sync/futex.h>
 
 namespace IPC {
-    class FunctionInvoker {
+    /**
+     * Thrown by a call the registry kept rejecting as busy, see ChannelOptions::max_queue_depth. The call did
+     * not run, so it is safe to try again later.
+     */
+    class ServerBusyError : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    /**
+     * Thrown by a call that failed in the registry, because the function threw or the call could not be
+     * decoded. Carries the message of the exception in the registry, the registry itself keeps running.
+     */
+    class FunctionCallError : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    /**
+     * A function of the registry resolved to its method ID, see FunctionInvoker::resolve().
+     */
+    template <typename Signature>
+    struct Method {
+        uint16_t id;
+
+        /// Priority and timeout of the calls through the method.
+        CallOptions options = {};
+    };
+
+    /**
+     * Holds a call slot, and the pool block of a return value that did not fit into it, until the response
+     * is consumed.
+     */
+    class SlotLease {
     public:
-        FunctionInvoker(std::string channel_name) {
-            size_t sync_shm_size = sizeof(pthread_mutex_t) + sizeof(pthread_cond_t) + 128;
+        SlotLease(SharedMemoryPool* pool, size_t slot_offset) : pool_(pool), slot_offset_(slot_offset) {}
+
+        SlotLease(SlotLease&& other) noexcept : pool_(other.pool_), slot_offset_(other.slot_offset_) {
+            other.pool_ = nullptr;
+        }
+
+        SlotLease(const SlotLease&) = delete;
+        SlotLease& operator=(const SlotLease&) = delete;
+        SlotLease& operator=(SlotLease&&) = delete;
+
+        ~SlotLease() {
+            if (pool_ == nullptr) {
+                return;
+            }
 
-            /// Create the shared memory for storing the data synchronization details.
-            sync_shm_manager_ = new SharedMemoryManager((channel_name + "_sync").c_str(), sync_shm_size, false);
-            if (sync_shm_manager_ == NULL) {
-                throw std::runtime_error("Failed to initialize sync shared memory");
+            Channel::SlotHeader* slot = (Channel::SlotHeader*)pool_->getBlockPointer(slot_offset_);
+            if (slot->reply_block != 0) {
+                pool_->release(slot->reply_block);
             }
+            pool_->release(slot_offset_);
+        }
+
+        size_t getOffset() const {
+            return slot_offset_;
+        }
+
+        /// Hands the slot over to the registry, which releases it once the abandoned call completes.
+        void detach() {
+            pool_ = nullptr;
+        }
+
+    private:
+        SharedMemoryPool* pool_;
+        size_t slot_offset_;
+    };
+
+    /**
+     * Return value of a call whose return type is a view (std::string_view, std::span<const std::byte>).
+     *
+     * The view points straight into the channel shared memory, so the Reply keeps the call slot until it is
+     * destroyed. Keep it short lived, every Reply holds one of the slots of the channel.
+     */
+    template <typename T>
+    class Reply {
+    public:
+        Reply(SlotLease&& lease, T value) : lease_(std::move(lease)), value_(value) {}
+
+        const T& get() const {
+            return value_;
+        }
+
+        const T& operator*() const {
+            return value_;
+        }
+
+        const T* operator->() const {
+            return &value_;
+        }
+
+    private:
+        SlotLease lease_;
+        T value_;
+    };
+
+    /**
+     * What call() returns for a function returning Ret, views are wrapped into a Reply.
+     */
+    template <typename Ret>
+    using CallResult = std::conditional_t<is_view_v<Ret>, Reply<Ret>, Ret>;
+
+    /**
+     * A call added to a CallBatch, used to read its result from the BatchResult.
+     */
+    template <typename Ret>
+    struct BatchEntry {
+        size_t index;
+    };
+
+    /**
+     * Calls that are submitted together with FunctionInvoker::invokeBatch(), the functions may differ.
+     *
+     * The calls are encoded when they are added and copied into a single call slot on submission, so the
+     * whole batch costs one submission, one wakeup of the registry and one completion.
+     */
+    class CallBatch {
+    public:
+        /**
+         * Adds a call to a function resolved with FunctionInvoker::resolve().
+         */
+        template <typename Signature, typename... CallArgs>
+        BatchEntry<typename FunctionTraits<Signature>::return_type> add(Method<Signature> method, const CallArgs&... args) {
+            using Traits = FunctionTraits<Signature>;
+            static_assert(sizeof...(CallArgs) == Traits::arity, "Argument count does not match the signature");
+            static_assert(!is_stream_v<typename Traits::return_type>, "Streaming functions cannot be called in a batch");
+
+            /// The method ID followed by the arguments, prefixed by their size
+            size_t call_size = sizeof(uint16_t) + Traits::argsSize(args...);
+            size_t offset = data_.size();
+            data_.resize(offset + varintSize(call_size) + call_size);
+
+            BufferWriter writer(data_.data() + offset, varintSize(call_size) + call_size);
+            writer.writeVarint(call_size);
+            Codec<uint16_t>::encode(writer, method.id);
+            Traits::encodeArgs(writer, args...);
+
+            return BatchEntry<typename Traits::return_type>{ call_count_++ };
+        }
+
+        /// Number of calls in the batch.
+        size_t size() const {
+            return call_count_;
+        }
+
+        /// Removes all calls so that the batch can be filled again.
+        void clear() {
+            data_.clear();
+            call_count_ = 0;
+        }
+
+    private:
+        friend class FunctionInvoker;
+
+        std::vector<char> data_;
+        uint32_t call_count_ = 0;
+    };
+
+    /**
+     * Return values of a submitted CallBatch, holds the call slot until it is destroyed. View return values
+     * point into the slot and are valid as long as the BatchResult.
+     */
+    class BatchResult {
+    public:
+        BatchResult(SlotLease&& lease, BufferReader replies, size_t call_count) : lease_(std::move(lease)) {
+            for (size_t i = 0; i < call_count; i++) {
+                /// The low bit of the size marks a failed call, see FunctionRegistry::BatchReplyBuffer
+                uint64_t prefix = replies.readVarint();
+                uint64_t size = prefix >> 1;
+                replies_.push_back(BufferReader(replies.read(size), size));
+                failed_.push_back(prefix & 1);
+            }
+        }
+
+        /// Returns the return value of the given call of the batch, throws FunctionCallError if the call failed.
+        template <typename Ret>
+        Ret get(BatchEntry<Ret> entry) const {
+            if (entry.index >= replies_.size()) {
+                throw std::runtime_error("Batch entry out of range");
+            }
+            if (failed_[entry.index]) {
+                BufferReader message = replies_[entry.index];
+                size_t size = message.remaining();
+                throw FunctionCallError(std::string(message.read(size), size));
+            }
+
+            if constexpr (!std::is_void_v<Ret>) {
+                BufferReader reply = replies_[entry.index];
+                return Codec<std::decay_t<Ret>>::decode(reply);
+            }
+        }
+
+        /// Number of calls in the batch.
+        size_t size() const {
+            return replies_.size();
+        }
+
+    private:
+        SlotLease lease_;
+        std::vector<BufferReader> replies_;
+        std::vector<bool> failed_;
+    };
+
+    class FunctionInvoker;
+
+    /**
+     * A submitted call whose response has not been read yet, returned by FunctionInvoker::callAsync().
+     *
+     * The call owns its slot until the future is destroyed, so any number of calls can be outstanding on one
+     * thread (up to the number of call slots of the channel). The result is read once with get(), or by
+     * awaiting the future in a C++20 coroutine:
+     *
+     * int ret = co_await invoker.callAsync<int(int, int)>("add", 1, 2);
+     *
+     * Awaiting coroutines are resumed on the completion thread of the invoker. A future that is destroyed
+     * before its call completes waits for the completion, since the registry still writes into the slot.
+     *
+     * wait() and get() throw if the call timed out (ChannelOptions::call_timeout_ms) or the registry died,
+     * the slot is then left to the registry.
+     */
+    template <typename Ret>
+    class CallFuture {
+    public:
+        CallFuture(FunctionInvoker* invoker, SlotLease&& lease, uint64_t request_id,
+            std::chrono::steady_clock::time_point deadline);
+
+        CallFuture(CallFuture&& other) noexcept;
+
+        ~CallFuture();
+
+        /**
+         * True if the response has arrived. A busy reply that is going to be retried (see
+         * ChannelOptions::busy_retry_count) is not a response, the retry is submitted by wait(), get() or the
+         * awaiting coroutine.
+         */
+        bool ready() const;
+
+        /// Blocks until the response has arrived, throws if it never will.
+        void wait();
+
+        /// Waits for the response and returns the result, can only be called once.
+        CallResult<Ret> get();
+
+        bool await_ready() const {
+            return ready();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle);
+
+        CallResult<Ret> await_resume() {
+            return get();
+        }
+
+    private:
+        FunctionInvoker* invoker_;
+        SlotLease lease_;
+        Channel::SlotHeader* slot_;
+        uint64_t request_id_;
+        std::chrono::steady_clock::time_point deadline_;
+        bool completed_ = false;
+        bool retrieved_ = false;
+
+        /// Number of times the call was submitted again after a busy reply.
+        uint32_t busy_retries_ = 0;
+
+        /// Set if the call was abandoned, the reason wait() throws.
+        const char* failure_ = nullptr;
+    };
+
+    /**
+     * The items of a call to a streaming function, returned by FunctionInvoker::stream().
+     *
+     * while (auto item = stream.next()) { ... }
+     *
+     * The items arrive in chunks through the call slot while the function runs, the stream owns the slot until
+     * it is destroyed. Destroying a stream before its last item was read cancels it, the function sees
+     * StreamWriter::write() fail.
+     *
+     * next() throws if no chunk arrives within ChannelOptions::call_timeout_ms or the registry died.
+     */
+    template <typename T>
+    class CallStream {
+        static_assert(!is_view_v<T>, "Stream items are copied out of the call slot, views cannot be streamed");
+
+    public:
+        CallStream(FunctionInvoker* invoker, SlotLease&& lease, uint64_t request_id);
+
+        CallStream(CallStream&& other) noexcept;
+
+        ~CallStream();
+
+        /// Returns the next item, waits for it if necessary. Returns nullopt once the function has returned.
+        std::optional<T> next();
+
+    private:
+        /// Waits for the next chunk of items or the completion of the call and copies it out of the slot.
+        void receive();
+
+        FunctionInvoker* invoker_;
+        SlotLease lease_;
+        Channel::SlotHeader* slot_;
+        uint64_t request_id_;
+
+        /// Encoded items of the last received chunk, the items before position_ are read.
+        std::vector<char> chunk_;
+        size_t position_ = 0;
+
+        /// True once the function returned or the stream was abandoned.
+        bool completed_ = false;
+
+        /// Number of times the call was submitted again after a busy reply.
+        uint32_t busy_retries_ = 0;
+    };
+
+    /**
+     * Client side of a channel. Calls may be made from any number of threads at once: every thread submits to
+     * its own lane (see ChannelOptions::lane) and keeps its own spin budget and block of request IDs, so
+     * concurrent calls share no cache line of the invoker. connect(), reconnect() and the destructor must not
+     * race with calls.
+     *
+     * The threads of a process should share one invoker per channel instead of mapping the channel once per
+     * thread, see shared().
+     */
+    class FunctionInvoker {
+    public:
+        /**
+         * Connects to the channel, waits until the registry has created it and started listening (see
+         * ChannelOptions::connect_timeout_ms).
+         */
+        FunctionInvoker(std::string channel_name, ChannelOptions options = {})
+            :channel_name_(channel_name), options_(options) {
+            connect();
+        }
 
-            /// Get the mutext and condition variable from the shared memory
-            mtx_ = (pthread_mutex_t*)sync_shm_manager_->getMemoryPointer(0);
-            cv_ = (pthread_cond_t*)sync_shm_manager_->getMemoryPointer(sizeof(pthread_mutex_t));
+        /**
+         * Returns the invoker of the channel shared by the whole process, connects it on first use. The
+         * connection lives as long as one of the returned pointers, a call after it was released or lost its
+         * registry (see isConnected()) connects again.
+         *
+         * The options of the call that connects apply, the options of the later calls are ignored.
+         */
+        static std::shared_ptr<FunctionInvoker> shared(const std::string& channel_name, ChannelOptions options = {}) {
+            struct SharedConnection {
+                std::mutex mtx;
+                std::weak_ptr<FunctionInvoker> invoker;
+            };
+            static std::mutex connections_mtx;
+            static std::map<std::string, std::shared_ptr<SharedConnection>, std::less<>> connections;
 
-            if (this->mtx_ == NULL || this->cv_ == NULL) {
-                throw std::runtime_error("Failed to load mutex or condition variable");
+            std::shared_ptr<SharedConnection> connection;
+            {
+                std::lock_guard<std::mutex> lock(connections_mtx);
+                std::shared_ptr<SharedConnection>& entry = connections[channel_name];
+                if (!entry) {
+                    entry = std::make_shared<SharedConnection>();
+                }
+                connection = entry;
             }
 
-            /// Create the shared memory manager for storing the function call data
-            fn_call_data_shm_manager_ =
-                new SharedMemoryManager(channel_name.c_str(), FUNCTION_CALL_DATA_SHM_SIZE, false);
+            /// Connecting may wait for the registry, so only the callers of the same channel wait for each other
+            std::lock_guard<std::mutex> lock(connection->mtx);
+            std::shared_ptr<FunctionInvoker> invoker = connection->invoker.lock();
+            if (!invoker || !invoker->isConnected()) {
+                invoker = std::make_shared<FunctionInvoker>(channel_name, options);
+                connection->invoker = invoker;
+            }
+            return invoker;
         }
 
         ~FunctionInvoker() {
-            fn_call_data_shm_manager_->~SharedMemoryManager();
-            delete fn_call_data_shm_manager_;
+            /// All awaited calls complete before the completion thread stops
+            completion_queue_.reset();
+
+            disconnect();
+        }
 
-            sync_shm_manager_->~SharedMemoryManager();
-            delete sync_shm_manager_;
+        /**
+         * Returns the ID the channel assigned to this invoker when it connected, the high bits of the IDs of
+         * its requests.
+         */
+        uint32_t getClientId() const {
+            return client_id_;
+        }
+
+        /**
+         * False once the channel this invoker is connected to was removed or its registry died, e.g. because
+         * the registry shut down or a restarted registry replaced it with a new channel of the same name.
+         */
+        bool isConnected() const {
+            return fn_call_data_shm_manager_ != nullptr && !fn_call_data_shm_manager_->isRemoved()
+                && fn_call_data_shm_manager_->isOwnerAlive();
+        }
+
+        /**
+         * Connects to the current channel of the registry again, e.g. after isConnected() turned false.
+         * No call may be in flight, futures and replies of the previous connection become invalid.
+         */
+        void reconnect() {
+            disconnect();
+            connect();
         }
 
         /**
          * Calls a function with the given name and arguments which is registered in the function registry
          * of another process.
+         *
+         * The arguments are type erased, so their codecs are picked at runtime. Prefer call(), it encodes the
+         * arguments without std::any.
          */
         template <typename Ret>
         std::any invoke(std::string name, const std::vector<std::any>& args) {
-            while (true) {
-                pthread_mutex_lock(mtx_);
+            static_assert(!is_view_v<Ret>, "Views cannot be returned through invoke(), use call()");
 
-                /// Check if a function call is in progress
-                if (((char*)fn_call_data_shm_manager_->getMemoryPointer())[0] != 0) {
-                    pthread_mutex_unlock(mtx_);
+            /// The signature is only known at runtime, so is its schema hash
+            SchemaHash schema;
+            schema.add(typeid(Ret));
+            size_t args_size = 0;
+            for (const auto& arg : args) {
+                visitArg(arg, [&args_size, &schema](const auto& value) {
+                    schema.add(typeid(std::decay_t<decltype(value)>));
+                    args_size += Codec<std::decay_t<decltype(value)>>::size(value);
+                    });
+            }
 
-                    continue;
-                }
-                else {
-                    /// No other function calls are in progress, so we can proceed with this function call
-                    break;
+            CallFuture<Ret> future = submitCall<Ret>(getMethodId(name, schema.value()), args_size, [&args](BufferWriter& writer) {
+                for (const auto& arg : args) {
+                    visitArg(arg, [&writer](const auto& value) {
+                        Codec<std::decay_t<decltype(value)>>::encode(writer, value);
+                        });
                 }
+                });
+
+            if constexpr (std::is_void_v<Ret>) {
+                future.get();
+                return std::any{};
+            }
+            else {
+                return future.get();
             }
+        }
 
-            /// UUID for the function call
-            std::string call_id = generate_uuid_v4();
+        /**
+         * Resolves the name of a registered function to its method ID. Calls through the returned Method skip
+         * the name lookup entirely.
+         *
+         * [options] Priority class and timeout of the calls through the Method, e.g. a health check that must
+         * not queue behind bulk calls:
+         * auto health = invoker.resolve<bool()>("health", { .priority = CallPriority::CRITICAL, .timeout_ms = 50 });
+         *
+         * Throws if the function is registered with another signature.
+         */
+        template <typename Signature>
+        Method<Signature> resolve(std::string_view name, CallOptions options = {}) const {
+            return Method<Signature>{ getMethodId(name, FunctionTraits<Signature>::schemaHash()), options };
+        }
 
-            size_t total_shm_size = 0;
-            total_shm_size += sizeof(size_t);  // Size of the call_id
-            total_shm_size += call_id.size();  // The call_id
-            total_shm_size += sizeof(size_t);  // Size of the method name
-            total_shm_size += name.size();     // The method name
-            total_shm_size += sizeof(size_t);  // Size of the number of arguments
-            total_shm_size += sizeof(size_t) * args.size();  // Size of the argument sizes
-            for (const auto& arg : args) {
-                if (arg.type().name() == typeid(std::string).name()) {
-                    total_shm_size += std::any_cast<std::string>(arg).size();
-                }
-                else if (arg.type().name() == typeid(int).name()) {
-                    total_shm_size += sizeof(int);
+        /**
+         * Calls a function registered in the function registry of another process through its signature,
+         * e.g. invoker.call<int(int, int)>("add", 1, 2).
+         *
+         * Size computation, encoding and decoding are generated at compile time from the signature, which
+         * must match the signature the function is registered with.
+         *
+         * std::string_view and std::span<const std::byte> arguments are copied once into the call slot and
+         * handed to the function as views into it, IPC::inPlace() fills an argument directly in the slot.
+         * Functions returning such a view return a Reply<View> that points into the channel shared memory.
+         */
+        template <typename Signature, typename... CallArgs>
+        CallResult<typename FunctionTraits<Signature>::return_type> call(std::string_view name, const CallArgs&... args) {
+            return call(resolve<Signature>(name), args...);
+        }
+
+        /**
+         * Calls a function resolved with resolve().
+         */
+        template <typename Signature, typename... CallArgs>
+        CallResult<typename FunctionTraits<Signature>::return_type> call(Method<Signature> method, const CallArgs&... args) {
+            using Ret = typename FunctionTraits<Signature>::return_type;
+            if constexpr (!is_view_v<Ret> && !std::is_void_v<Ret>) {
+                if (method.id < client_caches_.size() && client_caches_[method.id]) {
+                    return callCached(method, args...);
                 }
-                else if (arg.type().name() == typeid(double).name()) {
-                    total_shm_size += sizeof(double);
+            }
+            return callAsync(method, args...).get();
+        }
+
+        /**
+         * Submits a call like call() but returns without waiting for the response, e.g.
+         * auto sum = invoker.callAsync<int(int, int)>("add", 1, 2);
+         *
+         * The arguments are encoded before it returns, so they do not need to outlive the returned future.
+         */
+        template <typename Signature, typename... CallArgs>
+        CallFuture<typename FunctionTraits<Signature>::return_type> callAsync(std::string_view name, const CallArgs&... args) {
+            return callAsync(resolve<Signature>(name), args...);
+        }
+
+        /**
+         * Submits a call to a function resolved with resolve() without waiting for the response.
+         */
+        template <typename Signature, typename... CallArgs>
+        CallFuture<typename FunctionTraits<Signature>::return_type> callAsync(Method<Signature> method, const CallArgs&... args) {
+            using Traits = FunctionTraits<Signature>;
+            static_assert(sizeof...(CallArgs) == Traits::arity, "Argument count does not match the signature");
+
+            return submitCall<typename Traits::return_type>(method.id, Traits::argsSize(args...),
+                [&](BufferWriter& writer) { Traits::encodeArgs(writer, args...); }, method.options);
+        }
+
+        /**
+         * Calls a streaming function (see FunctionRegistry::registerStream()) through the item type and the
+         * argument types, e.g. invoker.stream<int(int)>("count", 10). Returns as soon as the call is
+         * submitted, the items are read from the returned CallStream.
+         */
+        template <typename Signature, typename... CallArgs>
+        CallStream<typename FunctionTraits<Signature>::return_type> stream(std::string_view name, const CallArgs&... args) {
+            using Traits = FunctionTraits<Signature>;
+            static_assert(sizeof...(CallArgs) == Traits::arity, "Argument count does not match the signature");
+
+            uint16_t method_id = getMethodId(name,
+                FunctionTraits<typename StreamSignature<Signature>::type>::schemaHash());
+            uint64_t request_id;
+            SlotLease lease = submitSlot(Channel::getPriorityFlags(CallPriority::NORMAL), method_id,
+                Traits::argsSize(args...), getCallDeadline(), request_id,
+                [&](BufferWriter& writer) { Traits::encodeArgs(writer, args...); });
+
+            return CallStream<typename Traits::return_type>(this, std::move(lease), request_id);
+        }
+
+        /**
+         * Submits all calls of the batch in a single call slot and waits for their return values. The registry
+         * runs the calls in order and completes the batch once, after the last call.
+         *
+         * [options] Priority class and timeout of the batch as a whole.
+         */
+        BatchResult invokeBatch(const CallBatch& batch, CallOptions options = {}) {
+            auto deadline = getCallDeadline(options);
+            uint64_t request_id;
+            SlotLease lease = submitSlot(Channel::SLOT_BATCH | Channel::getPriorityFlags(options.priority), 0,
+                sizeof(uint32_t) + batch.data_.size(), deadline, request_id, [&batch](BufferWriter& writer) {
+                    Codec<uint32_t>::encode(writer, batch.call_count_);
+                    writer.write(batch.data_.data(), batch.data_.size());
+                });
+
+            Channel::SlotHeader* slot = (Channel::SlotHeader*)call_pool_->getBlockPointer(lease.getOffset());
+            uint32_t retries = 0;
+            WaitResult result = waitForCompletion(slot, deadline, retries);
+            if (result != WaitResult::COMPLETED && abandonCall(slot)) {
+                lease.detach();
+                throw std::runtime_error(getFailureMessage(result));
+            }
+            BufferReader replies = readReply(slot, request_id);
+            return BatchResult(std::move(lease), replies, batch.call_count_);
+        }
+        /**
+         * Returns the hits and misses of the in-process result cache of a function registered with
+         * FunctionOptions::client_cache, zero for any other function.
+         */
+        CacheStats getCacheStats(std::string_view name) const {
+            auto method = method_ids_.find(name);
+            if (method == method_ids_.end()) {
+                throw std::runtime_error("Function not found");
+            }
+
+            const ResultCache* cache = client_caches_[method->second.id].get();
+            if (cache == nullptr) {
+                return CacheStats{};
+            }
+            return CacheStats{ cache->getHits(), cache->getMisses() };
+        }
+    private:
+        template <typename Ret>
+        friend class CallFuture;
+
+        template <typename T>
+        friend class CallStream;
+
+        /** Outcome of waiting for a call. */
+        enum class WaitResult {
+            COMPLETED,
+            TIMED_OUT,
+            REGISTRY_DIED,
+        };
+
+        /**
+         * Takes a call slot, writes the request into it and submits it to the registry.
+         *
+         * CALL SLOT DATA (after the slot header, whose frame header carries the method ID and the request ID)
+         * 1. Arguments, encoded by the codecs of their types
+         *
+         * [encode_args] Writes the encoded arguments, args_size bytes in total.
+         *
+         * Returns the future of the call, which owns the slot.
+         */
+        template <typename Ret, typename EncodeArgs>
+        CallFuture<Ret> submitCall(uint16_t method_id, size_t args_size, EncodeArgs encode_args,
+            const CallOptions& options = {}) {
+            auto deadline = getCallDeadline(options);
+            uint64_t request_id;
+            SlotLease lease = submitSlot(Channel::getPriorityFlags(options.priority), method_id, args_size, deadline,
+                request_id, encode_args);
+
+            return CallFuture<Ret>(this, std::move(lease), request_id, deadline);
+        }
+
+        /**
+         * Calls a function whose results this invoker caches, repeated calls with the same encoded arguments are
+         * answered from the cache without a round trip to the registry.
+         */
+        template <typename Signature, typename... CallArgs>
+        typename FunctionTraits<Signature>::return_type callCached(Method<Signature> method, const CallArgs&... args) {
+            using Traits = FunctionTraits<Signature>;
+            using Ret = std::decay_t<typename Traits::return_type>;
+            ResultCache& cache = *client_caches_[method.id];
+
+            /// The encoded arguments are the key, as in the cache of the registry
+            std::string key(Traits::argsSize(args...), '\0');
+            BufferWriter key_writer(key.data(), key.size());
+            Traits::encodeArgs(key_writer, args...);
+
+            std::optional<Ret> result;
+            if (cache.find(key, [&result](std::string_view encoded) {
+                BufferReader reader(encoded.data(), encoded.size());
+                result = Codec<Ret>::decode(reader);
+                })) {
+                return std::move(*result);
+            }
+
+            auto deadline = getCallDeadline(method.options);
+            uint64_t request_id;
+            SlotLease lease = submitSlot(Channel::getPriorityFlags(method.options.priority), method.id, key.size(),
+                deadline, request_id, [&key](BufferWriter& writer) { writer.write(key.data(), key.size()); });
+
+            Channel::SlotHeader* slot = (Channel::SlotHeader*)call_pool_->getBlockPointer(lease.getOffset());
+            uint32_t retries = 0;
+            WaitResult wait_result = waitForCompletion(slot, deadline, retries);
+            if (wait_result != WaitResult::COMPLETED && abandonCall(slot)) {
+                lease.detach();
+                throw std::runtime_error(getFailureMessage(wait_result));
+            }
+
+            BufferReader reply = readReply(slot, request_id);
+            size_t size = reply.remaining();
+            std::string_view encoded(reply.read(size), size);
+            cache.insert(key, encoded);
+
+            BufferReader reader(encoded.data(), encoded.size());
+            return Codec<Ret>::decode(reader);
+        }
+
+        /**
+         * Returns the point in time at which a call submitted now times out, see ChannelOptions::call_timeout_ms
+         * and CallOptions::timeout_ms.
+         */
+        std::chrono::steady_clock::time_point getCallDeadline(const CallOptions& options = {}) const {
+            int64_t timeout_ms = options.timeout_ms == CallOptions::CHANNEL_TIMEOUT
+                ? options_.call_timeout_ms : options.timeout_ms;
+            if (timeout_ms < 0) {
+                return std::chrono::steady_clock::time_point::max();
+            }
+            return std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        }
+
+        static const char* getFailureMessage(WaitResult result) {
+            return result == WaitResult::TIMED_OUT ? "Function call timed out" : "Function registry terminated";
+        }
+
+        /**
+         * Takes a call slot large enough for total_size bytes of request data, writes the request with
+         * encode_data and submits the slot to the registry.
+         *
+         * [flags] SlotFlags of the request, including its priority class.
+         * [method_id] Method ID of the called function, 0 for a batch.
+         * [deadline] Deadline of the call, also bounds the wait for a free slot. The registry skips the call if
+         * it is still queued at the deadline.
+         * [request_id] Set to the ID of the submitted request.
+         */
+        template <typename EncodeData>
+        SlotLease submitSlot(uint16_t flags, uint16_t method_id, size_t total_size, std::chrono::steady_clock::time_point deadline,
+            uint64_t& request_id, EncodeData encode_data) {
+            if (sizeof(Channel::SlotHeader) + total_size > call_pool_->getMaxBlockSize()) {
+                throw std::runtime_error("Function call data exceeds the call slot size");
+            }
+
+            /// Take the smallest slot the request fits into, it is owned by this call until the response is read
+            size_t slot_offset;
+            while (true) {
+                uint32_t release_count = call_pool_->getReleaseCount();
+                slot_offset = call_pool_->allocate(sizeof(Channel::SlotHeader) + total_size);
+                if (slot_offset != SharedMemoryPool::npos) {
+                    break;
                 }
-                else if (arg.type().name() == typeid(float).name()) {
-                    total_shm_size += sizeof(float);
+
+                /// Every slot is in flight or the memory cap is reached, park until a call releases its slot
+                auto remaining = deadline - std::chrono::steady_clock::now();
+                if (remaining.count() <= 0) {
+                    throw std::runtime_error("Timed out waiting for a free call slot");
                 }
-                else if (arg.type().name() == typeid(bool).name()) {
-                    total_shm_size += sizeof(bool);
+                auto timeout = std::min<std::chrono::nanoseconds>(
+                    std::chrono::milliseconds(LIVENESS_POLL_INTERVAL_MS), remaining);
+
+                timespec wait_time = { (time_t)(timeout.count() / 1000000000), (long)(timeout.count() % 1000000000) };
+                if (!call_pool_->waitForRelease(release_count, &wait_time) && !fn_call_data_shm_manager_->isOwnerAlive()) {
+                    throw std::runtime_error(getFailureMessage(WaitResult::REGISTRY_DIED));
                 }
             }
+            SlotLease lease(call_pool_, slot_offset);
+            Channel::SlotHeader* slot = (Channel::SlotHeader*)call_pool_->getBlockPointer(slot_offset);
+            slot->reply_block = 0;
+            slot->deadline_ns = Channel::getDeadlineNs(deadline);
 
-            /// Create the shm manager and write the function call data
-            SharedMemoryManager fn_call_details_shm_manager(call_id.c_str(), total_shm_size, true);
+            slot->frame.method_id = method_id;
+            slot->frame.flags = flags;
 
-            /// Write the call_id length
-            size_t offset = 0;
-            size_t call_id_len = call_id.size();
-            fn_call_details_shm_manager.writeData((void*)&call_id_len, sizeof(size_t), offset);
-            offset += sizeof(size_t);
+            /// The slot already identifies the call inside the channel, the request ID tells its uses apart
+            request_id = Channel::getRequestId(client_id_, nextRequestCounter());
+            slot->frame.request_id = request_id;
 
-            /// Write the call_id
-            fn_call_details_shm_manager.writeData((void*)call_id.c_str(), call_id_len, offset);
-            offset += call_id_len;
+            /// Encode the request straight into the slot
+            BufferWriter writer((char*)(slot + 1), total_size);
+            encode_data(writer);
 
-            /// Write the method name length
-            size_t method_name_len = name.size();
-            fn_call_details_shm_manager.writeData((void*)&method_name_len, sizeof(size_t), offset);
-            offset += sizeof(size_t);
+            slot->frame.payload_size = writer.size();
+            slot->state.store(Channel::SLOT_SUBMITTED, std::memory_order_relaxed);
 
-            /// Write the method name
-            fn_call_details_shm_manager.writeData((void*)name.c_str(), method_name_len, offset);
-            offset += method_name_len;
+            submitToLane(slot_offset);
+            return lease;
+        }
 
-            /// Write the number of arguments
-            size_t num_args = args.size();
-            fn_call_details_shm_manager.writeData((void*)&num_args, sizeof(size_t), offset);
-            offset += sizeof(size_t);
+        /**
+         * Queues a written slot on the lane of the calling thread and wakes the listener of the lane if needed.
+         */
+        void submitToLane(size_t slot_offset) {
+            /// No lock is taken so any number of calls can be queued at once
+            Lane& lane = lanes_[pickLane()];
+            while (!lane.ring->push(slot_offset)) {
+                std::this_thread::yield();
+            }
 
-            /// Write the arguments
-            for (const auto& arg : args) {
-                if (arg.type().name() == typeid(std::string).name()) {
-                    std::string arg_str = std::any_cast<std::string>(arg);
-                    size_t arg_len = arg_str.size();
-                    fn_call_details_shm_manager.writeData((void*)&arg_len, sizeof(size_t), offset);
-                    offset += sizeof(size_t);
-
-                    fn_call_details_shm_manager.writeData((void*)arg_str.c_str(), arg_len, offset);
-                    offset += arg_len;
-                }
-                else if (arg.type().name() == typeid(int).name()) {
-                    int arg_int = std::any_cast<int>(arg);
-                    size_t arg_len = sizeof(int);
+            /// Ring the doorbell if the listener of the lane is parked, nobody else is woken
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (lane.header->server_waiting.load(std::memory_order_relaxed) != 0) {
+                lane.header->doorbell.fetch_add(1, std::memory_order_release);
+                Futex::wake(&lane.header->doorbell);
+            }
+        }
 
-                    fn_call_details_shm_manager.writeData((void*)&arg_len, sizeof(size_t), offset);
-                    offset += sizeof(size_t);
+        /**
+         * Returns the lane a call of the calling thread is submitted to, see ChannelOptions::lane.
+         */
+        size_t pickLane() const {
+            if (lanes_.size() == 1) {
+                return 0;
+            }
 
-                    fn_call_details_shm_manager.writeData((void*)&arg_int, arg_len, offset);
-                    offset += arg_len;
+            if (options_.lane == ChannelOptions::LANE_BY_CPU) {
+                int cpu = sched_getcpu();
+                if (cpu >= 0) {
+                    return (size_t)cpu % lanes_.size();
                 }
-                else if (arg.type().name() == typeid(double).name()) {
-                    double arg_double = std::any_cast<double>(arg);
-                    size_t arg_len = sizeof(double);
+            }
+            else if (options_.lane >= 0) {
+                return (size_t)options_.lane % lanes_.size();
+            }
+
+            return std::hash<std::thread::id>()(std::this_thread::get_id()) % lanes_.size();
+        }
 
-                    fn_call_details_shm_manager.writeData((void*)&arg_len, sizeof(size_t), offset);
-                    offset += sizeof(size_t);
+        /**
+         * Returns a reader over the encoded return value of a completed call, which is placed either after the
+         * request in the slot or in a separate block of the pool.
+         */
+        BufferReader readReply(Channel::SlotHeader* slot, uint64_t request_id) {
+            if (slot->frame.request_id != request_id) {
+                throw std::runtime_error("Response does not match the request");
+            }
 
-                    fn_call_details_shm_manager.writeData((void*)&arg_double, arg_len, offset);
-                    offset += arg_len;
+            if (slot->reply_size == Channel::RETURN_OVERFLOW) {
+                throw std::runtime_error("Return value exceeds the call slot size");
+            }
+            if (slot->reply_size == Channel::RETURN_EXPIRED) {
+                throw std::runtime_error("Function call expired before it ran");
+            }
+            if (slot->reply_size == Channel::RETURN_BUSY) {
+                throw ServerBusyError("Function registry is busy");
+            }
+            if (slot->reply_size == Channel::RETURN_ERROR) {
+                std::string message = "Function call failed";
+                if (slot->reply_offset != 0) {
+                    /// Bounded by the mapping, the registry truncates the message to the room in the slot
+                    size_t mapped = fn_call_data_shm_manager_->getSize();
+                    BufferReader reader((const char*)fn_call_data_shm_manager_->getMemoryPointer(slot->reply_offset),
+                        slot->reply_offset < mapped ? mapped - slot->reply_offset : 0);
+                    message = Codec<std::string>::decode(reader);
                 }
-                else if (arg.type().name() == typeid(float).name()) {
-                    float arg_float = std::any_cast<float>(arg);
+                throw FunctionCallError(message);
+            }
 
-                    size_t arg_len = sizeof(float);
+            /// Validates that the return value is inside the mapping
+            fn_call_data_shm_manager_->getMemoryPointer(slot->reply_offset + slot->reply_size);
+            return BufferReader((const char*)fn_call_data_shm_manager_->getMemoryPointer(slot->reply_offset),
+                slot->reply_size);
+        }
 
-                    fn_call_details_shm_manager.writeData((void*)&arg_len, sizeof(size_t), offset);
-                    offset += sizeof(size_t);
+        /**
+         * Maps the channel shared memory and loads the method table, retries if the channel is replaced while
+         * waiting for the registry.
+         */
+        void connect() {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max<int64_t>(0, options_.connect_timeout_ms));
+
+            while (true) {
+                /// Map the channel shared memory that holds the submission rings and the call slot pool, its size and
+                /// the part to prefault depend on the memory cap the registry publishes in the channel header
+                SharedMemoryOptions memory = options_.memory;
+                memory.prefault_size = 0;
+                memory.open_timeout_ms = options_.connect_timeout_ms < 0 ? -1 : std::max<int64_t>(0,
+                    std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count());
+                fn_call_data_shm_manager_ =
+                    new SharedMemoryManager(channel_name_.c_str(), 0, false, false, memory);
 
-                    fn_call_details_shm_manager.writeData((void*)&arg_float, arg_len, offset);
-                    offset += arg_len;
+                /// The segment has its size before the registry formats it, the pool and the rings are attached once
+                /// the method table is sealed, which the registry does after formatting them
+                try {
+                    if (fn_call_data_shm_manager_->getSize() < Channel::getPoolOffset()) {
+                        throw std::runtime_error("Invalid size of the channel shared memory");
+                    }
+                    if (loadMethodTable(deadline)) {
+                        joinChannel();
+                        return;
+                    }
+                }
+                catch (...) {
+                    disconnect();
+                    throw;
                 }
-                else if (arg.type().name() == typeid(bool).name()) {
-                    bool arg_bool = std::any_cast<bool>(arg);
-                    size_t arg_len = sizeof(bool);
 
-                    fn_call_details_shm_manager.writeData((void*)&arg_len, sizeof(size_t), offset);
-                    offset += sizeof(size_t);
+                /// The registry went away before it started listening, wait for its successor
+                disconnect();
 
-                    fn_call_details_shm_manager.writeData((void*)&arg_bool, arg_len, offset);
-                    offset += arg_len;
+                /// A crashed registry leaves its channel behind until the successor replaces it
+                if (options_.connect_timeout_ms >= 0 && std::chrono::steady_clock::now() >= deadline) {
+                    throw std::runtime_error("Timed out waiting for the function registry");
                 }
+                std::this_thread::sleep_for(std::chrono::milliseconds(LIVENESS_POLL_INTERVAL_MS));
             }
+        }
 
-            /// Write the function call data
-            offset = 0;
-            fn_call_data_shm_manager_->writeData((void*)call_id.c_str(), 128, offset);
-            offset += 128;
+        /**
+         * Attaches the call slot pool and the lanes the registry serves, which are formatted and fixed before the
+         * method table is sealed, and takes the client ID of this invoker.
+         */
+        void joinChannel() {
+            Channel::ChannelHeader* channel_header =
+                (Channel::ChannelHeader*)fn_call_data_shm_manager_->getMemoryPointer(Channel::HEADER_OFFSET);
+            if (channel_header->lane_count == 0 || channel_header->lane_count > Channel::MAX_LANES) {
+                throw std::runtime_error("Invalid lane count of the channel");
+            }
+            if (fn_call_data_shm_manager_->getSize() < Channel::getShmSize(channel_header->memory_cap)) {
+                throw std::runtime_error("Invalid size of the channel shared memory");
+            }
 
-            /// Write the size of the shm
-            fn_call_data_shm_manager_->writeData((void*)&total_shm_size, sizeof(size_t), offset);
-            offset += sizeof(size_t);
+            call_pool_ = new SharedMemoryPool(fn_call_data_shm_manager_, Channel::getPoolOffset(),
+                Channel::getSlotClasses(channel_header->memory_cap), false);
+            fn_call_data_shm_manager_->prefault(Channel::getPrefaultSize(channel_header->memory_cap));
 
-            /// Awake the listener
-            pthread_cond_broadcast(cv_);
-            pthread_mutex_unlock(mtx_);
+            for (size_t lane = 0; lane < channel_header->lane_count; lane++) {
+                lanes_.push_back({
+                    (Channel::LaneHeader*)fn_call_data_shm_manager_->getMemoryPointer(Channel::getLaneOffset(lane)),
+                    new SharedMemoryRing(fn_call_data_shm_manager_, Channel::getRingOffset(lane),
+                        Channel::RING_CAPACITY, false) });
+            }
 
-            /// Wait for the response
-            while (true) {
-                pthread_mutex_lock(mtx_);
-                pthread_cond_wait(cv_, mtx_);
+            client_id_ = channel_header->next_client_id.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void disconnect() {
+            delete call_pool_;
+            for (Lane& lane : lanes_) {
+                delete lane.ring;
+            }
+            delete fn_call_data_shm_manager_;
+
+            call_pool_ = nullptr;
+            lanes_.clear();
+            fn_call_data_shm_manager_ = nullptr;
+            method_ids_.clear();
+            client_caches_.clear();
+        }
 
-                /// Check if a function call is completed
-                if (((char*)fn_call_data_shm_manager_->getMemoryPointer())[0] != 0) {
-                    pthread_mutex_unlock(mtx_);
-                    continue;
+        /**
+         * Reads the method table the registry publishes when it is sealed, waits until it is published.
+         *
+         * Returns false if the channel was removed or its registry died, throws if the connect timeout expires.
+         */
+        bool loadMethodTable(std::chrono::steady_clock::time_point deadline) {
+            Channel::MethodTableHeader* method_table =
+                (Channel::MethodTableHeader*)fn_call_data_shm_manager_->getMemoryPointer(Channel::METHOD_TABLE_OFFSET);
+            while (method_table->sealed.load(std::memory_order_acquire) == 0) {
+                /// Wake up now and then to notice a channel that is removed before it is ever sealed
+                auto timeout = std::chrono::nanoseconds(std::chrono::milliseconds(LIVENESS_POLL_INTERVAL_MS));
+                if (options_.connect_timeout_ms >= 0) {
+                    auto remaining = deadline - std::chrono::steady_clock::now();
+                    if (remaining.count() <= 0) {
+                        throw std::runtime_error("Timed out waiting for the function registry");
+                    }
+                    timeout = std::min<std::chrono::nanoseconds>(timeout, remaining);
                 }
-                else {
-                    break;
+
+                timespec wait_time = { (time_t)(timeout.count() / 1000000000), (long)(timeout.count() % 1000000000) };
+                if (!Futex::wait(&method_table->sealed, 0, &wait_time) && (fn_call_data_shm_manager_->isRemoved()
+                    || !fn_call_data_shm_manager_->isOwnerAlive())) {
+                    return false;
                 }
             }
 
-            if (typeid(Ret) == typeid(void)) {
-                return std::any{};
+            if (!fn_call_data_shm_manager_->isOwnerAlive()) {
+                return false;
             }
 
-            /// Read the return value
-            SharedMemoryManager return_size_shm_manager(
-                (call_id + "_ret_size").c_str(), sizeof(size_t), false);
-            size_t* ret_size = (size_t*)(return_size_shm_manager.getMemoryPointer());
+            /// The channel header is written before the table is sealed
+            const Channel::ChannelHeader* channel_header =
+                (const Channel::ChannelHeader*)fn_call_data_shm_manager_->getMemoryPointer(Channel::HEADER_OFFSET);
+            if (channel_header->version != Channel::WIRE_VERSION) {
+                throw std::runtime_error("Wire format version of the function registry does not match");
+            }
 
-            std::any ret;
-            if (*ret_size > 0) {
-                SharedMemoryManager ret_shm_manager((call_id + "_ret").c_str(), *ret_size, false);
+            BufferReader reader((const char*)(method_table + 1), std::min<size_t>(method_table->data_size,
+                Channel::METHOD_TABLE_SIZE - sizeof(Channel::MethodTableHeader)));
+            client_caches_.resize(method_table->method_count);
+            for (uint32_t method_id = 0; method_id < method_table->method_count; method_id++) {
+                Channel::MethodTableEntry entry;
+                entry.name = Codec<std::string>::decode(reader);
+                entry.schema_hash = Codec<uint64_t>::decode(reader);
+                entry.client_cache_size = Codec<uint64_t>::decode(reader);
+                entry.cache_ttl_ms = Codec<int64_t>::decode(reader);
 
-                if (typeid(Ret) == typeid(std::string)) {
-                    ret = std::string((char*)ret_shm_manager.getMemoryPointer(), *ret_size);
+                method_ids_[entry.name] = MethodEntry{ (uint16_t)method_id, entry.schema_hash };
+                if (entry.client_cache_size > 0) {
+                    client_caches_[method_id] = std::make_unique<ResultCache>(entry.client_cache_size,
+                        entry.cache_ttl_ms);
                 }
-                else if (typeid(Ret) == typeid(int)) {
-                    ret = *((int*)ret_shm_manager.getMemoryPointer());
-                }
-                else if (typeid(Ret) == typeid(double)) {
-                    ret = *((double*)ret_shm_manager.getMemoryPointer());
-                }
-                else if (typeid(Ret) == typeid(float)) {
-                    ret = *((float*)ret_shm_manager.getMemoryPointer());
+            }
+            return true;
+        }
+
+        /**
+         * Returns the method ID of the registered function with the given name, throws if the function is
+         * registered with another SchemaHash.
+         */
+        uint16_t getMethodId(std::string_view name, uint64_t schema_hash) const {
+            auto method = method_ids_.find(name);
+            if (method == method_ids_.end()) {
+                throw std::runtime_error("Function not found");
+            }
+
+            if (method->second.schema_hash != schema_hash) {
+                throw std::runtime_error("Function signature does not match the registered function");
+            }
+
+            return method->second.id;
+        }
+
+        /**
+         * Calls the visitor with the value held by a type erased argument.
+         */
+        template <typename Visitor>
+        static void visitArg(const std::any& arg, Visitor visitor) {
+            if (arg.type() == typeid(std::string)) {
+                visitor(std::any_cast<const std::string&>(arg));
+            }
+            else if (arg.type() == typeid(int)) {
+                visitor(std::any_cast<int>(arg));
+            }
+            else if (arg.type() == typeid(double)) {
+                visitor(std::any_cast<double>(arg));
+            }
+            else if (arg.type() == typeid(float)) {
+                visitor(std::any_cast<float>(arg));
+            }
+            else if (arg.type() == typeid(bool)) {
+                visitor(std::any_cast<bool>(arg));
+            }
+            else {
+                throw std::runtime_error(std::string("Unsupported argument type: ") + arg.type().name());
+            }
+        }
+
+        /**
+         * Waits until the registry completes the call in the given slot, the deadline passes or the registry
+         * dies.
+         */
+        WaitResult waitForCompletion(Channel::SlotHeader* slot, std::chrono::steady_clock::time_point deadline,
+            uint32_t& retries) {
+            return waitForState(slot, deadline, Channel::SLOT_COMPLETED, retries);
+        }
+
+        /**
+         * Waits until the state of the given slot has one of the ready bits set (SLOT_COMPLETED, or SLOT_ITEMS
+         * for a stream), the deadline passes or the registry dies.
+         *
+         * A call the registry rejected as busy is submitted again after a randomized exponential backoff, see
+         * getBusyRetryTime(). The backoff sleeps on the waiting thread.
+         *
+         * [retries] Busy retry counter of the call, counts the retries of all waits of the call.
+         */
+        WaitResult waitForState(Channel::SlotHeader* slot, std::chrono::steady_clock::time_point deadline,
+            uint32_t ready, uint32_t& retries) {
+            while (true) {
+                WaitResult result = waitForStateOnce(slot, deadline, ready);
+                if (result != WaitResult::COMPLETED
+                    || !(slot->state.load(std::memory_order_acquire) & Channel::SLOT_COMPLETED)
+                    || slot->reply_size != Channel::RETURN_BUSY) {
+                    return result;
                 }
-                else if (typeid(Ret) == typeid(bool)) {
-                    ret = *((bool*)ret_shm_manager.getMemoryPointer());
+
+                std::optional<std::chrono::steady_clock::time_point> retry_time =
+                    getBusyRetryTime(deadline, retries);
+                if (!retry_time) {
+                    /// The busy reply is read as the outcome of the call
+                    return result;
                 }
+                std::this_thread::sleep_until(*retry_time);
+                resubmitCall(slot, Channel::SLOT_SUBMITTED);
+            }
+        }
 
-                ret_shm_manager.removeMemory();
+        /**
+         * Returns when a call the registry rejected as busy is submitted again and counts the retry, nullopt if
+         * the call already was retried ChannelOptions::busy_retry_count times or the backoff would end after its
+         * deadline. The backoff is randomized and doubled for every retry.
+         */
+        std::optional<std::chrono::steady_clock::time_point> getBusyRetryTime(
+            std::chrono::steady_clock::time_point deadline, uint32_t& retries) {
+            if (retries >= options_.busy_retry_count) {
+                return std::nullopt;
             }
-            return_size_shm_manager.removeMemory();
 
-            pthread_cond_broadcast(cv_);
-            pthread_mutex_unlock(mtx_);
+            int64_t backoff_us = options_.busy_backoff_us << std::min<uint32_t>(retries, 20);
+            backoff_us = backoff_us / 2 + (int64_t)(getThreadState().random() % (uint64_t)(backoff_us / 2 + 1));
+            auto retry_time = std::chrono::steady_clock::now() + std::chrono::microseconds(backoff_us);
+            if (retry_time >= deadline) {
+                return std::nullopt;
+            }
+            retries++;
+            return retry_time;
+        }
 
-            return ret;
+        /// Submits a call the registry rejected as busy again, the registry left the request untouched.
+        void resubmitCall(Channel::SlotHeader* slot, uint32_t state) {
+            slot->state.store(state, std::memory_order_relaxed);
+            submitToLane((char*)slot - (char*)fn_call_data_shm_manager_->getMemoryPointer());
         }
-    private:
+
         /**
-         * Generate a UUID v4 string
+         * Waits for one of the ready bits of the slot without retrying busy calls, see waitForState().
+         *
+         * The completion word is polled for the configured spin budget first. After that the invoker flags the
+         * slot as waited on and parks on the completion word, the registry only issues a wake for flagged slots.
+         * The park is cut into LIVENESS_POLL_INTERVAL_MS slices to check the deadline and the registry in between.
          */
-        static std::string generate_uuid_v4() {
-            std::random_device rd;
-            std::mt19937_64 gen(rd());  // 64-bit Mersenne Twister PRNG
-            std::uniform_int_distribution<uint64_t> dis(0, UINT64_MAX);
+        WaitResult waitForStateOnce(Channel::SlotHeader* slot, std::chrono::steady_clock::time_point deadline,
+            uint32_t ready) {
+            auto is_ready = [slot, ready] {
+                return (slot->state.load(std::memory_order_acquire) & ready) != 0;
+            };
+            if (getThreadState().completion_spin->spinUntil(is_ready)) {
+                return WaitResult::COMPLETED;
+            }
+
+            /// Flag the slot unless it got ready between the last poll and the flag
+            uint32_t state = slot->state.load(std::memory_order_acquire);
+            while (!(state & ready) && !(state & Channel::SLOT_WAITING)) {
+                if (slot->state.compare_exchange_weak(state, state | Channel::SLOT_WAITING,
+                    std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    state |= Channel::SLOT_WAITING;
+                }
+            }
 
-            uint8_t uuid[16];
+            while (!(state & ready)) {
+                auto timeout = std::chrono::nanoseconds(std::chrono::milliseconds(LIVENESS_POLL_INTERVAL_MS));
+                auto remaining = deadline - std::chrono::steady_clock::now();
+                if (remaining.count() <= 0) {
+                    return WaitResult::TIMED_OUT;
+                }
+                timeout = std::min<std::chrono::nanoseconds>(timeout, remaining);
 
-            // Generate 16 random bytes
-            for (int i = 0; i < 16; i += 8) {
-                uint64_t part = dis(gen);
-                std::memcpy(uuid + i, &part, sizeof(part));
+                timespec wait_time = { (time_t)(timeout.count() / 1000000000), (long)(timeout.count() % 1000000000) };
+                if (!Futex::wait(&slot->state, state, &wait_time)
+                    && !is_ready() && !fn_call_data_shm_manager_->isOwnerAlive()) {
+                    return WaitResult::REGISTRY_DIED;
+                }
+                state = slot->state.load(std::memory_order_acquire);
             }
+            return WaitResult::COMPLETED;
+        }
 
-            // Set the version (4) -> Bits 12-15 of time_hi_and_version
-            uuid[6] = (uuid[6] & 0x0F) | 0x40;
+        /**
+         * Gives up on a call that has not completed, the registry releases its slot once the function returns.
+         *
+         * Returns false if the call completed in the meantime, its response can be read as usual then.
+         */
+        bool abandonCall(Channel::SlotHeader* slot) {
+            uint32_t state = slot->state.load(std::memory_order_acquire);
+            while (state != Channel::SLOT_COMPLETED) {
+                if (slot->state.compare_exchange_weak(state, state | Channel::SLOT_ABANDONED,
+                    std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    /// A streaming function may be parked until its chunk is taken
+                    if (state & Channel::SLOT_SERVER_WAITING) {
+                        Futex::wake(&slot->state);
+                    }
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * State of the calling thread for this invoker, kept apart from the invoker so that calls of different
+         * threads write to no shared cache line.
+         */
+        struct ThreadState {
+            /// Instance of the invoker the state belongs to, 0 for an unused state.
+            uint64_t instance = 0;
+
+            /// Value of the use counter of the thread when the state was last used, the oldest state is reused.
+            uint64_t last_use = 0;
+
+            /// Spin budget for waiting on call completions.
+            std::optional<AdaptiveSpin> completion_spin;
 
-            // Set the variant (RFC 4122) -> Bits 6-7 of clock_seq_hi_and_reserved
-            uuid[8] = (uuid[8] & 0x3F) | 0x80;
+            /// Request counters reserved by this thread, next_request up to request_end.
+            uint64_t next_request = 0;
+            uint64_t request_end = 0;
 
-            // Convert to UUID string format
-            std::ostringstream oss;
-            for (int i = 0; i < 16; ++i) {
-                if (i == 4 || i == 6 || i == 8 || i == 10) oss << "-";
-                oss << std::hex << std::setw(2) << std::setfill('0') << (int)uuid[i];
+            /// Randomizes the busy backoff.
+            std::minstd_rand random{ (uint32_t)std::hash<std::thread::id>()(std::this_thread::get_id()) };
+        };
+
+        /**
+         * Returns the state of the calling thread for this invoker. A thread keeps the states of the last
+         * THREAD_STATE_COUNT invokers it called, so a thread that alternates between invokers keeps the spin
+         * budget and the request block of each of them.
+         */
+        ThreadState& getThreadState() {
+            thread_local std::array<ThreadState, THREAD_STATE_COUNT> states;
+            thread_local uint64_t uses = 0;
+
+            ThreadState* oldest = &states[0];
+            for (ThreadState& state : states) {
+                if (state.instance == instance_) {
+                    state.last_use = ++uses;
+                    return state;
+                }
+                if (state.last_use < oldest->last_use) {
+                    oldest = &state;
+                }
             }
 
-            return oss.str();
+            oldest->instance = instance_;
+            oldest->last_use = ++uses;
+            oldest->completion_spin.emplace(options_.spin_count);
+            oldest->next_request = oldest->request_end = 0;
+            return *oldest;
         }
 
         /**
-             * The mutex and the condition variable are used to synchronize access to the registry.
-             */
-        pthread_mutex_t* mtx_;
-        pthread_cond_t* cv_;
+         * Returns the counter of the next request of the calling thread. Threads reserve REQUEST_BLOCK_SIZE
+         * counters at once, so request IDs stay unique per invoker but only increase per thread.
+         */
+        uint64_t nextRequestCounter() {
+            ThreadState& state = getThreadState();
+            if (state.next_request == state.request_end) {
+                state.next_request = next_request_id_.fetch_add(REQUEST_BLOCK_SIZE, std::memory_order_relaxed);
+                state.request_end = state.next_request + REQUEST_BLOCK_SIZE;
+            }
+            return state.next_request++;
+        }
+
+        /**
+         * Returns the completion queue that resumes awaiting coroutines, it is created on first use.
+         */
+        CompletionQueue& getCompletionQueue() {
+            std::call_once(completion_queue_once_, [this] {
+                Channel::ChannelHeader* channel_header =
+                    (Channel::ChannelHeader*)fn_call_data_shm_manager_->getMemoryPointer(Channel::HEADER_OFFSET);
+                completion_queue_ = std::make_unique<CompletionQueue>(&channel_header->completions,
+                    [this] { return fn_call_data_shm_manager_->isOwnerAlive(); },
+                    [this](std::chrono::steady_clock::time_point deadline, uint32_t& retries) {
+                        return getBusyRetryTime(deadline, retries);
+                    },
+                    [this](Channel::SlotHeader* slot, uint32_t state) { resubmitCall(slot, state); });
+                });
+            return *completion_queue_;
+        }
+
+        /** Interval in which a waiting invoker checks whether the channel was removed or its registry died. */
+        static constexpr int LIVENESS_POLL_INTERVAL_MS = 100;
 
-        /**Shared memory that hold the mutex and condition variable */
-        SharedMemoryManager* sync_shm_manager_;
+        /** Number of invokers a thread keeps its state for, see getThreadState(). */
+        static constexpr size_t THREAD_STATE_COUNT = 4;
 
-        /** Shared memory that holds the basic details of the function calls, like the SHM name and size
-         * that holds the full function call details.
+        /** Number of request counters a thread reserves at once. */
+        static constexpr uint64_t REQUEST_BLOCK_SIZE = 1024;
+
+        /** Source of the instance numbers of the invokers of the process. */
+        static inline std::atomic<uint64_t> next_instance_{ 1 };
+
+        /** Number of this invoker in the process, tells the ThreadStates of different invokers apart. */
+        const uint64_t instance_ = next_instance_.fetch_add(1, std::memory_order_relaxed);
+
+        /** Name of the channel. */
+        std::string channel_name_;
+
+        /** Options of this side of the channel. */
+        ChannelOptions options_;
+
+        /** Shared memory that holds the channel header, the submission rings and the call slot pool.
          */
-        SharedMemoryManager* fn_call_data_shm_manager_;
+        SharedMemoryManager* fn_call_data_shm_manager_ = nullptr;
+
+        /** A lane of the channel, its ring of submitted call slots is consumed by the lane listener. */
+        struct Lane {
+            Channel::LaneHeader* header;
+            SharedMemoryRing* ring;
+        };
+
+        /** Lanes of the channel, indexed by lane. */
+        std::vector<Lane> lanes_;
+
+        /** Pool of request/response slots inside the channel shared memory. */
+        SharedMemoryPool* call_pool_ = nullptr;
+
+        /** Method ID and SchemaHash of a registered function. */
+        struct MethodEntry {
+            uint16_t id;
+            uint64_t schema_hash;
+        };
+
+        /** Method entries of the registered functions by name, read from the method table once. */
+        std::map<std::string, MethodEntry, std::less<>> method_ids_;
+
+        /** In-process result caches indexed by method ID, only set for functions registered with a client cache. */
+        std::vector<std::unique_ptr<ResultCache>> client_caches_;
+
+        /** Client ID assigned by the channel when this invoker connected, the high bits of its request IDs. */
+        uint32_t client_id_ = 0;
+
+        /** Start of the next block of request counters a thread reserves, the low bits of the request IDs. */
+        std::atomic<uint64_t> next_request_id_{ 1 };
+
+        /** Resumes coroutines awaiting calls, see CallFuture. */
+        std::unique_ptr<CompletionQueue> completion_queue_;
+        std::once_flag completion_queue_once_;
     };
-}
\ No newline at end of file
+
+    template <typename Ret>
+    CallFuture<Ret>::CallFuture(FunctionInvoker* invoker, SlotLease&& lease, uint64_t request_id,
+        std::chrono::steady_clock::time_point deadline)
+        : invoker_(invoker), lease_(std::move(lease)), request_id_(request_id), deadline_(deadline) {
+        slot_ = (Channel::SlotHeader*)invoker_->call_pool_->getBlockPointer(lease_.getOffset());
+    }
+
+    template <typename Ret>
+    CallFuture<Ret>::CallFuture(CallFuture&& other) noexcept
+        : invoker_(other.invoker_), lease_(std::move(other.lease_)), slot_(other.slot_),
+        request_id_(other.request_id_), deadline_(other.deadline_), completed_(other.completed_),
+        retrieved_(other.retrieved_), busy_retries_(other.busy_retries_), failure_(other.failure_) {
+        /// The moved from future no longer owns the slot
+        other.completed_ = true;
+    }
+
+    template <typename Ret>
+    CallFuture<Ret>::~CallFuture() {
+        try {
+            wait();
+        }
+        catch (const std::exception&) {
+            /// The call was abandoned, its slot belongs to the registry now
+        }
+    }
+
+    template <typename Ret>
+    bool CallFuture<Ret>::ready() const {
+        if (completed_) {
+            return true;
+        }
+        return slot_->state.load(std::memory_order_acquire) == Channel::SLOT_COMPLETED
+            && !(slot_->reply_size == Channel::RETURN_BUSY && busy_retries_ < invoker_->options_.busy_retry_count);
+    }
+
+    template <typename Ret>
+    void CallFuture<Ret>::wait() {
+        if (!completed_) {
+            auto result = invoker_->waitForCompletion(slot_, deadline_, busy_retries_);
+            completed_ = true;
+            if (result != FunctionInvoker::WaitResult::COMPLETED && invoker_->abandonCall(slot_)) {
+                lease_.detach();
+                failure_ = FunctionInvoker::getFailureMessage(result);
+            }
+        }
+
+        if (failure_ != nullptr) {
+            throw std::runtime_error(failure_);
+        }
+    }
+
+    template <typename Ret>
+    CallResult<Ret> CallFuture<Ret>::get() {
+        if (retrieved_) {
+            throw std::runtime_error("Call result already retrieved");
+        }
+        retrieved_ = true;
+
+        wait();
+        BufferReader reply = invoker_->readReply(slot_, request_id_);
+        if constexpr (is_view_v<Ret>) {
+            Ret value = Codec<Ret>::decode(reply);
+            return Reply<Ret>(std::move(lease_), value);
+        }
+        else if constexpr (!std::is_void_v<Ret>) {
+            return Codec<std::decay_t<Ret>>::decode(reply);
+        }
+    }
+
+    template <typename Ret>
+    void CallFuture<Ret>::await_suspend(std::coroutine_handle<> handle) {
+        invoker_->getCompletionQueue().add(slot_, deadline_, &busy_retries_, handle);
+    }
+
+    template <typename T>
+    CallStream<T>::CallStream(FunctionInvoker* invoker, SlotLease&& lease, uint64_t request_id)
+        : invoker_(invoker), lease_(std::move(lease)), request_id_(request_id) {
+        slot_ = (Channel::SlotHeader*)invoker_->call_pool_->getBlockPointer(lease_.getOffset());
+    }
+
+    template <typename T>
+    CallStream<T>::CallStream(CallStream&& other) noexcept
+        : invoker_(other.invoker_), lease_(std::move(other.lease_)), slot_(other.slot_),
+        request_id_(other.request_id_), chunk_(std::move(other.chunk_)), position_(other.position_),
+        completed_(other.completed_), busy_retries_(other.busy_retries_) {
+        /// The moved from stream no longer owns the slot
+        other.completed_ = true;
+    }
+
+    template <typename T>
+    CallStream<T>::~CallStream() {
+        if (!completed_ && invoker_->abandonCall(slot_)) {
+            /// The function is still running, the registry releases the slot once it returns
+            lease_.detach();
+        }
+    }
+
+    template <typename T>
+    std::optional<T> CallStream<T>::next() {
+        while (position_ >= chunk_.size()) {
+            if (completed_) {
+                return std::nullopt;
+            }
+            receive();
+        }
+
+        BufferReader reader(chunk_.data() + position_, chunk_.size() - position_);
+        uint64_t size = reader.readVarint();
+        BufferReader item(reader.read(size), size);
+        position_ = chunk_.size() - reader.remaining();
+        return Codec<T>::decode(item);
+    }
+
+    template <typename T>
+    void CallStream<T>::receive() {
+        auto result = invoker_->waitForState(slot_, invoker_->getCallDeadline(),
+            Channel::SLOT_ITEMS | Channel::SLOT_COMPLETED, busy_retries_);
+        if (result != FunctionInvoker::WaitResult::COMPLETED && invoker_->abandonCall(slot_)) {
+            lease_.detach();
+            completed_ = true;
+            throw std::runtime_error(FunctionInvoker::getFailureMessage(result));
+        }
+
+        /// A chunk is only ever published while the previous one is taken, the completion carries the rest
+        uint32_t state = slot_->state.load(std::memory_order_acquire);
+        BufferReader reply = invoker_->readReply(slot_, request_id_);
+        size_t size = reply.remaining();
+        const char* data = reply.read(size);
+        chunk_.assign(data, data + size);
+        position_ = 0;
+
+        if (state == Channel::SLOT_COMPLETED) {
+            completed_ = true;
+            return;
+        }
+
+        /// Hand the reply area back to the function, wake it if it waits for it
+        uint32_t previous = slot_->state.fetch_and(
+            ~(uint32_t)(Channel::SLOT_ITEMS | Channel::SLOT_WAITING | Channel::SLOT_SERVER_WAITING),
+            std::memory_order_acq_rel);
+        if (previous & Channel::SLOT_SERVER_WAITING) {
+            Futex::wake(&slot_->state);
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <iostream>
+#include <sstream>
+
+/// Compile time log level of the registry and the invoker: 0 none, 1 errors, 2 info, 3 debug (every call).
+#ifndef FUNCTION_LOG_LEVEL
+#define FUNCTION_LOG_LEVEL 0
+#endif
+
+namespace IPC {
+    namespace Log {
+        enum Level : int {
+            ERROR = 1,
+            INFO = 2,
+            DEBUG = 3,
+        };
+
+        /**
+         * Writes a line to std::clog if the level is enabled, otherwise the call compiles to nothing.
+         *
+         * Log::write<Log::DEBUG>("Method to execute: ", name);
+         */
+        template <int level, typename... Parts>
+        inline void write(const Parts&... parts) {
+            if constexpr (level <= FUNCTION_LOG_LEVEL) {
+                /// Formatted first so that lines of concurrent workers do not interleave
+                std::ostringstream line;
+                (line << ... << parts) << '\n';
+                std::clog << line.str();
+            }
+        }
+    }
+}
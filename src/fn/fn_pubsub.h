@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fn/fn_codec.h>
+#include <shm_manager/shm_broadcast.h>
+#include <shm_manager/shm_manager.h>
+
+/// Default number of messages a topic keeps, see TopicOptions::capacity.
+#ifndef FUNCTION_TOPIC_CAPACITY
+#define FUNCTION_TOPIC_CAPACITY 1024
+#endif
+
+/// Default maximum size of an encoded topic message, see TopicOptions::message_size.
+#ifndef FUNCTION_TOPIC_MESSAGE_SIZE
+#define FUNCTION_TOPIC_MESSAGE_SIZE 256
+#endif
+
+namespace IPC {
+    /**
+     * Options of a topic, given to the Publisher or the Subscriber.
+     */
+    struct TopicOptions {
+        /// Publisher only. Number of messages the topic keeps (a power of two), slower subscribers lose the older ones.
+        size_t capacity = FUNCTION_TOPIC_CAPACITY;
+
+        /// Publisher only. Maximum size of an encoded message.
+        size_t message_size = FUNCTION_TOPIC_MESSAGE_SIZE;
+
+        /// Subscriber only. How long the subscriber waits for the publisher to create the topic, -1 waits forever.
+        int64_t connect_timeout_ms = -1;
+
+        /// Placement of the topic shared memory in this process, huge_pages must be the same on both sides.
+        SharedMemoryOptions memory;
+    };
+
+    /**
+     * A topic broadcasts messages of a single type from one Publisher to any number of Subscribers of the same
+     * channel. The publisher never waits for subscribers: every subscriber keeps its own position and one that
+     * falls behind by more than the capacity skips the messages that were overwritten and counts them as lost.
+     *
+     * Every topic lives in its own shared memory segment ("<channel name>-topic-<topic name>"), so topics are
+     * independent of each other and of the registry of the channel.
+     *
+     * TOPIC SHARED MEMORY STRUCTURE DETAILS
+     * 1. Topic header (TopicHeader, one cache line)
+     * 2. Broadcast ring (SharedMemoryBroadcastRing) of encoded messages
+     *
+     * The publisher holds the owner lock of the segment (SharedMemoryManager::isOwnerAlive()), a restarted
+     * publisher replaces the segment and its subscribers have to subscribe again.
+     */
+    namespace Topic {
+        constexpr size_t CACHE_LINE_SIZE = 64;
+        constexpr uint64_t MAGIC = 0x6369706f74637066; // "fpctopic"
+        constexpr uint32_t VERSION = 1;
+
+        struct alignas(CACHE_LINE_SIZE) TopicHeader {
+            /// MAGIC once the broadcast ring is formatted.
+            std::atomic<uint64_t> magic;
+            uint32_t version;
+            uint32_t reserved;
+
+            /// SchemaHash of the message type, subscribers of another type refuse to subscribe.
+            uint64_t schema_hash;
+
+            uint64_t capacity;
+            uint64_t message_size;
+        };
+
+        constexpr size_t RING_OFFSET = sizeof(TopicHeader);
+
+        /// Total size of the topic shared memory.
+        inline size_t getShmSize(size_t capacity, size_t message_size) {
+            return RING_OFFSET + SharedMemoryBroadcastRing::requiredSize(capacity, message_size);
+        }
+
+        /// Name of the shared memory of a topic of a channel.
+        inline std::string getShmName(const std::string& channel_name, const std::string& topic_name) {
+            return channel_name + "-topic-" + topic_name;
+        }
+
+        /// SchemaHash of a message type, the hash of a function without arguments that returns it.
+        template <typename T>
+        uint64_t schemaHash() {
+            return FunctionTraits<T()>::schemaHash();
+        }
+    }
+
+    /**
+     * Writer of a topic, there must be only one per topic. Not thread safe.
+     *
+     * Publisher<Quote> quotes("market", "quotes");
+     * quotes.publish({ "ABC", 101.5 });
+     */
+    template <typename T>
+    class Publisher {
+    public:
+        Publisher(std::string channel_name, std::string topic_name, TopicOptions options = {}) {
+            shm_ = new SharedMemoryManager(Topic::getShmName(channel_name, topic_name),
+                Topic::getShmSize(options.capacity, options.message_size), true, false, options.memory);
+
+            try {
+                header_ = new(shm_->getMemoryPointer()) Topic::TopicHeader{ {0}, Topic::VERSION, 0,
+                    Topic::schemaHash<T>(), options.capacity, options.message_size };
+                ring_ = new SharedMemoryBroadcastRing(shm_, Topic::RING_OFFSET, options.capacity,
+                    options.message_size, true);
+            }
+            catch (...) {
+                shm_->removeMemory();
+                delete shm_;
+                throw;
+            }
+
+            header_->magic.store(Topic::MAGIC, std::memory_order_release);
+        }
+
+        ~Publisher() {
+            delete ring_;
+            shm_->removeMemory();
+            delete shm_;
+        }
+
+        Publisher(const Publisher&) = delete;
+        Publisher& operator=(const Publisher&) = delete;
+
+        /**
+         * Encodes the message straight into the ring and publishes it, returns its sequence number.
+         * Throws if the encoded message is larger than TopicOptions::message_size.
+         */
+        uint64_t publish(const T& message) {
+            size_t size = Codec<T>::size(message);
+            if (size > ring_->getMaxMessageSize()) {
+                throw std::runtime_error("Topic message exceeds the message size of the topic");
+            }
+
+            BufferWriter writer(ring_->beginWrite(), size);
+            Codec<T>::encode(writer, message);
+            return ring_->endWrite(size);
+        }
+
+        /// Number of messages published so far.
+        uint64_t getPublished() const {
+            return ring_->getHead();
+        }
+
+    private:
+        SharedMemoryManager* shm_;
+        Topic::TopicHeader* header_;
+        SharedMemoryBroadcastRing* ring_;
+    };
+
+    /**
+     * Reader of a topic. It starts with the next message published after it subscribed. Not thread safe, every
+     * thread that reads a topic needs its own subscriber.
+     *
+     * Subscriber<Quote> quotes("market", "quotes");
+     * while (auto quote = quotes.next()) { ... }
+     */
+    template <typename T>
+    class Subscriber {
+        static_assert(!is_view_v<T>, "Topic messages are copied out of the ring, views cannot be received");
+
+    public:
+        Subscriber(std::string channel_name, std::string topic_name, TopicOptions options = {}) {
+            auto deadline = std::chrono::steady_clock::now()
+                + std::chrono::milliseconds(std::max<int64_t>(0, options.connect_timeout_ms));
+
+            /// Mapped writable, waiting subscribers register themselves in the ring
+            SharedMemoryOptions memory = options.memory;
+            memory.open_timeout_ms = options.connect_timeout_ms;
+            shm_ = new SharedMemoryManager(Topic::getShmName(channel_name, topic_name), 0, false, false, memory);
+
+            try {
+                if (shm_->getSize() < sizeof(Topic::TopicHeader)) {
+                    throw std::runtime_error("Invalid topic shared memory");
+                }
+
+                /// The segment is sized before the publisher formats it
+                header_ = (Topic::TopicHeader*)shm_->getMemoryPointer();
+                while (header_->magic.load(std::memory_order_acquire) != Topic::MAGIC) {
+                    if (options.connect_timeout_ms >= 0 && std::chrono::steady_clock::now() >= deadline) {
+                        throw std::runtime_error("Timed out waiting for the topic publisher");
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+
+                if (header_->version != Topic::VERSION
+                    || shm_->getSize() < Topic::getShmSize(header_->capacity, header_->message_size)) {
+                    throw std::runtime_error("Invalid topic shared memory");
+                }
+                if (header_->schema_hash != Topic::schemaHash<T>()) {
+                    throw std::runtime_error("Message type does not match the type of the topic");
+                }
+
+                ring_ = new SharedMemoryBroadcastRing(shm_, Topic::RING_OFFSET, header_->capacity,
+                    header_->message_size, false);
+            }
+            catch (...) {
+                delete shm_;
+                throw;
+            }
+
+            sequence_ = ring_->getHead();
+        }
+
+        ~Subscriber() {
+            delete ring_;
+            delete shm_;
+        }
+
+        Subscriber(const Subscriber&) = delete;
+        Subscriber& operator=(const Subscriber&) = delete;
+
+        /// Returns the next message if one was published, without waiting.
+        std::optional<T> tryNext() {
+            if (!ring_->read(sequence_, buffer_, lost_)) {
+                return std::nullopt;
+            }
+
+            BufferReader reader(buffer_.data(), buffer_.size());
+            return Codec<T>::decode(reader);
+        }
+
+        /**
+         * Blocks until the next message is published.
+         *
+         * [timeout_ms] How long to wait, -1 waits forever.
+         *
+         * Returns nullopt if the wait timed out or the publisher is gone.
+         */
+        std::optional<T> next(int64_t timeout_ms = -1) {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max<int64_t>(0, timeout_ms));
+
+            while (true) {
+                if (std::optional<T> message = tryNext()) {
+                    return message;
+                }
+                if (!isPublisherAlive()) {
+                    return std::nullopt;
+                }
+
+                /// Parks in slices, so that a publisher that crashes is noticed
+                int64_t slice_ms = LIVENESS_POLL_INTERVAL_MS;
+                if (timeout_ms >= 0) {
+                    int64_t remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline - std::chrono::steady_clock::now()).count();
+                    if (remaining_ms <= 0) {
+                        return tryNext();
+                    }
+                    slice_ms = std::min(slice_ms, remaining_ms);
+                }
+
+                timespec timeout = { slice_ms / 1000, (slice_ms % 1000) * 1000000 };
+                ring_->wait(sequence_, &timeout);
+            }
+        }
+
+        /// Number of messages this subscriber lost because the publisher overwrote them before they were read.
+        uint64_t getLost() const {
+            return lost_;
+        }
+
+        /// Sequence number of the next message this subscriber reads.
+        uint64_t getSequence() const {
+            return sequence_;
+        }
+
+        /// Number of published messages this subscriber has not read yet, including the ones it is going to lose.
+        uint64_t getBacklog() const {
+            uint64_t head = ring_->getHead();
+            return head > sequence_ ? head - sequence_ : 0;
+        }
+
+        /// False once the publisher exited or was replaced by a new one.
+        bool isPublisherAlive() const {
+            return shm_->isOwnerAlive() && !shm_->isRemoved();
+        }
+
+    private:
+        static constexpr int64_t LIVENESS_POLL_INTERVAL_MS = 100;
+
+        SharedMemoryManager* shm_;
+        Topic::TopicHeader* header_;
+        SharedMemoryBroadcastRing* ring_;
+
+        uint64_t sequence_ = 0;
+        uint64_t lost_ = 0;
+        std::vector<char> buffer_;
+    };
+}
@@ -1,107 +1,99 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <exception>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include <pthread.h>
+#include <sched.h>
 
 #include <fn/fn.h>
+#include <fn/fn_channel.h>
+#include <fn/fn_dispatch_pool.h>
+#include <fn/fn_log.h>
+#include <fn/fn_stats.h>
 #include <shm_manager/shm_manager.h>
-
-#ifndef FUNCTION_CALL_DATA_SHM_SIZE
-#define FUNCTION_CALL_DATA_SHM_SIZE 256
-#endif
+#include <shm_manager/shm_pool.h>
+#include <shm_manager/shm_ring.h>
+#include <sync/futex.h>
 
 namespace IPC {
     class FunctionRegistry {
     public:
-        FunctionRegistry(std::string channel_name) :channel_name_(channel_name) {
+        FunctionRegistry(std::string channel_name, ChannelOptions options = {})
+            :channel_name_(channel_name), options_(options), submission_spin_(options.spin_count) {
+            if (options_.lane_count == 0 || options_.lane_count > Channel::MAX_LANES) {
+                throw std::runtime_error("Lane count must be between 1 and FUNCTION_CHANNEL_MAX_LANES");
+            }
 
             /**
              * SHARED MEMEORY STRUCTURE DETAILS
-             * (The shared memory contains the following data in the given order)
-             *
-             * 1. Mutex
-             * 2. Condition Variable
-             *
-             * (The below data are saved in another SHM)
-             * 3. Method call ID length (size_t)
-             * 4. Method call ID (char*) - This is used as the channel_name for the shared memory that should
-             * be created by the client to store the return value of the function.
-             *
-             * 5. Method name length (size_t)
-             * 6. Method name (char*)
+             * (The below data are saved in a call slot of the channel arena after the slot header, whose
+             * frame header carries the method ID, the request ID and the payload size, see fn_channel.h)
              *
-             * 7. Number of arguments (size_t)
-             * 8. Argument 1 length (size_t)
-             * 9. Argument 1 (char*)
-             * 10. Argument 2 length (size_t)
-             * 11. Argument 2 (char*)
+             * 1. Argument 1, encoded by the codec of its type (see fn_codec.h)
+             * 2. Argument 2
              * ...
+             *
+             * A batch slot (SLOT_BATCH) holds the number of calls (uint32_t) followed by the calls, every
+             * call prefixed by its size (varint) and made of its method ID (uint16_t) and its arguments. Its
+             * return value is the list of the encoded return values of the calls, every one prefixed by its
+             * size (varint).
              */
 
-             /// 128 bytes is taken as the extra size for the shared memory.
-            size_t sync_shm_size = sizeof(pthread_mutex_t) + sizeof(pthread_cond_t) + 128;
-
             /**
-             * The fn_call shm usually contains the a UUIDv4 which is 128 bytes long.
-             * Taking 256 bytes as the size of the shared memory. (Including some extra space)
+             * The fn_call shm is created once and reused by every call on the channel.
              *
-             * Data Order: (Total 256 bits)
-             * 1. Shared memory name that holds the function call related data (128 bits)
-             * 2. Size of the shared memory (size_t)
-             * 3- Padding
+             * Data Order:
+             * 1. Channel header
+             * 2. Lane headers
+             * 3. Method table, written when the registry is sealed
+             * 4. Submission rings holding the offsets of the submitted call slots, one per lane
+             * 5. Call slot pool
              */
-            size_t fn_call_data_shm_size = FUNCTION_CALL_DATA_SHM_SIZE;
-
-            /// Create the shared memory for storing the data synchronization details.
-            sync_shm_manager_ = new SharedMemoryManager((channel_name_ + "_sync").c_str(), sync_shm_size, true);
-            if (sync_shm_manager_ == NULL) {
-                throw std::runtime_error("Failed to initialize sync shared memory");
+            /// Initialize the function call related data shm
+            SharedMemoryOptions memory = options_.memory;
+            memory.prefault_size = Channel::getPrefaultSize(options_.memory_cap);
+            fn_call_data_shm_manager_ = new SharedMemoryManager(channel_name_.c_str(),
+                Channel::getShmSize(options_.memory_cap), true, false, memory);
+            if (fn_call_data_shm_manager_ == NULL) {
+                throw std::runtime_error("Failed to initialize function call data shared memory");
             }
 
-            /// Initialize the mutex and condition variable
-            mtx_ = new(sync_shm_manager_->getMemoryPointer(0)) pthread_mutex_t;
-            cv_ = new(sync_shm_manager_->getMemoryPointer(sizeof(pthread_mutex_t))) pthread_cond_t;
-
-            pthread_mutexattr_t mutexAttr;
-            pthread_mutexattr_init(&mutexAttr);
-            pthread_mutexattr_setpshared(&mutexAttr, PTHREAD_PROCESS_SHARED);
-            pthread_mutex_init(mtx_, &mutexAttr);
-            pthread_mutexattr_destroy(&mutexAttr);
+            channel_header_ = new(fn_call_data_shm_manager_->getMemoryPointer(Channel::HEADER_OFFSET))
+                Channel::ChannelHeader{ Channel::WIRE_VERSION, (uint32_t)options_.lane_count, options_.memory_cap, {1}, {0} };
 
-            pthread_condattr_t condAttr;
-            pthread_condattr_init(&condAttr);
-            pthread_condattr_setpshared(&condAttr, PTHREAD_PROCESS_SHARED);
-            pthread_cond_init(cv_, &condAttr);
-            pthread_condattr_destroy(&condAttr);
+            method_table_ = new(fn_call_data_shm_manager_->getMemoryPointer(Channel::METHOD_TABLE_OFFSET))
+                Channel::MethodTableHeader{ {0}, 0, 0 };
 
-            if (this->mtx_ == NULL || this->cv_ == NULL) {
-                throw std::runtime_error("Failed to initialize mutex or condition variable");
-            }
-
-            /// Initialize the function call related data shm
-            fn_call_data_shm_manager_ = new SharedMemoryManager(channel_name_.c_str(), fn_call_data_shm_size, true);
-            if (fn_call_data_shm_manager_ == NULL) {
-                throw std::runtime_error("Failed to initialize function call data shared memory");
+            /// Empty submission rings mean no function call is currently in progress.
+            for (size_t lane = 0; lane < options_.lane_count; lane++) {
+                lane_headers_.push_back(new(fn_call_data_shm_manager_->getMemoryPointer(Channel::getLaneOffset(lane)))
+                    Channel::LaneHeader{ {0}, {0} });
+                submission_rings_.push_back(new SharedMemoryRing(fn_call_data_shm_manager_,
+                    Channel::getRingOffset(lane), Channel::RING_CAPACITY, true));
             }
 
-            /**
-             * Initialize the function call data shared memory with all zeros.
-             *
-             * 0 means no function call is currently in progress.
-             */
-            memset(fn_call_data_shm_manager_->getMemoryPointer(), 0, fn_call_data_shm_size);
+            call_pool_ = new SharedMemoryPool(fn_call_data_shm_manager_, Channel::getPoolOffset(),
+                Channel::getSlotClasses(options_.memory_cap), true, Channel::getPoolLimits(options_));
         }
 
         ~FunctionRegistry() {
-            delete mtx_;
-            delete cv_;
+            delete call_pool_;
+            for (SharedMemoryRing* ring : submission_rings_) {
+                delete ring;
+            }
 
             fn_call_data_shm_manager_->removeMemory();
             delete fn_call_data_shm_manager_;
 
-            sync_shm_manager_->removeMemory();
-            delete sync_shm_manager_;
-
             for (const auto& [name, fn] : registered_fns_) {
                 delete fn;
             }
@@ -109,169 +101,951 @@ namespace IPC {
 
         /**
          * Registers a function with the registry.
+         *
+         * [options] Per function options, e.g. whether the function may run concurrently on several workers.
          */
         template <typename Ret, typename... Args>
-        void registerFunction(std::string name, std::function<Ret(Args...)> func) {
-            registered_fns_[name] = new IPC::Function(name, func);
+        void registerFunction(std::string name, std::function<Ret(Args...)> func, FunctionOptions options = {}) {
+            if (sealed_) {
+                throw std::runtime_error("Functions cannot be registered after the registry is sealed");
+            }
+
+            registered_fns_[name] = new IPC::Function(name, func, options);
+        }
+
+        /**
+         * Registers a free function (or a static member function) named at compile time. The registry calls it
+         * directly from the dispatch thunk, without a std::function in between, and takes its signature from
+         * the pointer:
+         *
+         * registry.registerFunction<&add>("add");
+         */
+        template <auto Fn>
+        void registerFunction(std::string name, FunctionOptions options = {}) {
+            if (sealed_) {
+                throw std::runtime_error("Functions cannot be registered after the registry is sealed");
+            }
+
+            registered_fns_[name] = new IPC::Function(name, FunctionPointer<Fn>{}, options);
+        }
+
+        /**
+         * Registers a streaming function, which sends any number of items to the invoker through its
+         * StreamWriter while it runs. Invokers read the items with FunctionInvoker::stream().
+         *
+         * registry.registerStream<int, int>("count", std::function<void(StreamWriter<int>&, int)>(
+         *     [](StreamWriter<int>& out, int n) {
+         *         for (int i = 0; i < n && out.write(i); i++) {}
+         *     }));
+         *
+         * A streaming function keeps its dispatch thread until it returns, use ChannelOptions::worker_count
+         * to run several streams at once.
+         */
+        template <typename T, typename... Args>
+        void registerStream(std::string name, std::function<void(StreamWriter<T>&, Args...)> func,
+            FunctionOptions options = {}) {
+            if (sealed_) {
+                throw std::runtime_error("Functions cannot be registered after the registry is sealed");
+            }
+
+            registered_fns_[name] = new IPC::Function(name, func, options);
+        }
+
+        /**
+         * Assigns the method IDs and publishes the method table to the invokers, no function can be registered
+         * afterwards. listen() seals the registry if it is not sealed yet.
+         *
+         * The method IDs are dense, so a call is dispatched by indexing the dispatch table with its method ID.
+         */
+        void seal() {
+            if (sealed_) {
+                return;
+            }
+
+            char* data = (char*)(method_table_ + 1);
+            BufferWriter writer(data, Channel::METHOD_TABLE_SIZE - sizeof(Channel::MethodTableHeader));
+            if (registered_fns_.size() > Channel::MAX_METHOD_COUNT) {
+                throw std::runtime_error("Too many registered functions");
+            }
+
+            for (const auto& [name, fn] : registered_fns_) {
+                const FunctionOptions& options = fn->getOptions();
+                Codec<std::string>::encode(writer, name);
+                Codec<uint64_t>::encode(writer, fn->getSchemaHash());
+                Codec<uint64_t>::encode(writer, options.client_cache ? options.cache_size : 0);
+                Codec<int64_t>::encode(writer, options.cache_ttl_ms);
+                dispatch_table_.push_back(fn);
+            }
+
+            if (writer.overflowed()) {
+                dispatch_table_.clear();
+                throw std::runtime_error("Registered function names exceed the method table size");
+            }
+
+            for (size_t method_id = 0; method_id < dispatch_table_.size(); method_id++) {
+                stream_functions_ |= dispatch_table_[method_id]->isStream();
+                if (!dispatch_table_[method_id]->getOptions().reentrant) {
+                    serial_queues_.resize(dispatch_table_.size());
+                    serial_queues_[method_id] = std::make_unique<SerialQueue>();
+                }
+            }
+
+            method_table_->method_count = dispatch_table_.size();
+            method_table_->data_size = writer.size();
+            sealed_ = true;
+            method_table_->sealed.store(1, std::memory_order_release);
+            Futex::wakeAll(&method_table_->sealed);
         }
 
         /**
          * Listen for the incoming function calls.
          *
-         * If the fn_call data sh contains a non-zero value, then it means a function call is in progress.
+         * Every lane of the channel has a listener, lane 0 is served by the calling thread and every further
+         * lane by a thread of its own. Submitted call slots are taken from the submission ring of the lane in
+         * order. When the ring is empty the listener polls it for the configured spin budget and then parks on
+         * the doorbell of its lane.
+         *
+         * With ChannelOptions::worker_count set the calls of all lanes are run by a pool of worker threads,
+         * otherwise they run on the listener of their lane one at a time.
+         *
+         * Never returns unless a listener fails: the other listeners are stopped and joined then, and the error
+         * is rethrown.
          */
         void listen() {
-            while (true) {
-                pthread_mutex_lock(mtx_);
+            seal();
+
+            if constexpr (Stats::ENABLED) {
+                /// Cell i belongs to the listener of lane i, cell lane_count + i to dispatch worker i
+                std::vector<std::string> names;
+                for (Function* fn : dispatch_table_) {
+                    names.push_back(fn->getName());
+                }
+                stats_ = std::make_unique<ChannelStats>(channel_name_, names,
+                    options_.lane_count + options_.worker_count);
+            }
 
-                std::cout << "Waiting for signal..." << std::endl;
-                pthread_cond_wait(cv_, mtx_);
+            std::unique_ptr<DispatchPool> dispatch_pool;
+            if (options_.worker_count > 0) {
+                dispatch_pool = std::make_unique<DispatchPool>(options_.worker_count,
+                    [this, &dispatch_pool](size_t worker, uint64_t slot_offset) {
+                        dispatchCall(options_.lane_count + worker, slot_offset);
+                        sampleQueues(dispatch_pool.get());
+                    });
+            }
+
+            Log::write<Log::INFO>("Listening on channel ", channel_name_, " with ", options_.lane_count, " lanes");
+            stopping_.store(false, std::memory_order_relaxed);
+            LaneListeners lane_listeners(this);
+            for (size_t lane = 1; lane < options_.lane_count; lane++) {
+                lane_listeners.start(lane, dispatch_pool.get());
+            }
+            listenLane(0, dispatch_pool.get());
+            lane_listeners.join();
+        }
+    private:
+        /// A call dispatched through the serial queues of the non reentrant functions.
+        struct SerialCall {
+            uint64_t slot_offset;
+
+            /// Identifies the dispatch of the call, its slot may be reused as soon as the call completes
+            uint64_t token;
 
-                std::cout << "Condition variable signal recieved" << std::endl;
+            std::chrono::steady_clock::time_point parked_at{};
+        };
 
-                /// Check if a function call is in progress
-                if (((char*)fn_call_data_shm_manager_->getMemoryPointer())[0] == 0) {
-                    pthread_mutex_unlock(mtx_);
+        /**
+         * Serializes the calls of a non reentrant function without blocking a dispatch thread. The call that
+         * runs owns the queue, the calls that arrive meanwhile are parked in it by priority class and handed
+         * the queue one at a time by the thread that finishes the call before them.
+         */
+        struct SerialQueue {
+            std::mutex mtx;
+            bool running = false;
+            uint64_t owner = 0;
+            std::deque<SerialCall> parked[Channel::PRIORITY_COUNT];
+        };
+
+        /**
+         * Threads of the listeners of the lanes after lane 0. Stops and joins them when listen() unwinds, so
+         * that no listener outlives the dispatch pool it submits to.
+         */
+        class LaneListeners {
+        public:
+            explicit LaneListeners(FunctionRegistry* registry) : registry_(registry) {}
+
+            ~LaneListeners() {
+                registry_->stopListeners();
+                for (std::thread& thread : threads_) {
+                    thread.join();
+                }
+            }
+
+            LaneListeners(const LaneListeners&) = delete;
+            LaneListeners& operator=(const LaneListeners&) = delete;
+
+            /// A listener that throws stops the other ones, its error is rethrown by join().
+            void start(size_t lane, DispatchPool* dispatch_pool) {
+                threads_.emplace_back([this, lane, dispatch_pool] {
+                    try {
+                        registry_->listenLane(lane, dispatch_pool);
+                    }
+                    catch (...) {
+                        {
+                            std::lock_guard<std::mutex> lock(mtx_);
+                            if (!error_) {
+                                error_ = std::current_exception();
+                            }
+                        }
+                        registry_->stopListeners();
+                    }
+                    });
+            }
+
+            /// Joins the listeners once they stopped, rethrows the error of the listener that failed.
+            void join() {
+                for (std::thread& thread : threads_) {
+                    thread.join();
+                }
+                threads_.clear();
 
+                if (error_) {
+                    std::rethrow_exception(error_);
+                }
+            }
+
+        private:
+            FunctionRegistry* registry_;
+            std::vector<std::thread> threads_;
+            std::mutex mtx_;
+            std::exception_ptr error_;
+        };
+
+        /**
+         * Makes every lane listener return, the parked ones are woken through their doorbells.
+         */
+        void stopListeners() {
+            stopping_.store(true, std::memory_order_relaxed);
+            for (size_t lane = 0; lane < options_.lane_count; lane++) {
+                lane_headers_[lane]->doorbell.fetch_add(1, std::memory_order_release);
+                Futex::wakeAll(&lane_headers_[lane]->doorbell);
+            }
+        }
+
+        /**
+         * Takes the submitted calls of a lane and runs or dispatches them until stopListeners() is called.
+         */
+        void listenLane(size_t lane, DispatchPool* dispatch_pool) {
+            if (options_.pin_lanes) {
+                pinToCpu(lane);
+            }
+
+            SharedMemoryRing* submission_ring = submission_rings_[lane];
+
+            /// Calls taken from the ring that did not run yet by priority class, the dispatch pool keeps its own
+            std::deque<uint64_t> pending[Channel::PRIORITY_COUNT];
+            size_t pending_count = 0;
+            while (!stopping_.load(std::memory_order_relaxed)) {
+                uint64_t slot_offset;
+                if (dispatch_pool) {
+                    if (!submission_ring->pop(slot_offset)) {
+                        waitForSubmission(lane, dispatch_pool);
+                        continue;
+                    }
+
+                    if (admitCall(lane, slot_offset)) {
+                        dispatch_pool->submit(slot_offset, getSlotPriority(slot_offset));
+                    }
+                    sampleQueues(dispatch_pool);
                     continue;
                 }
 
-                /// Read the function call data
-                char* shm_name = new char[129];
-                fn_call_data_shm_manager_->readData(shm_name, 128, 0);
-                shm_name[128] = '\0';
+                /// Take everything submitted so far, so that the call of the highest priority class runs next
+                while (submission_ring->pop(slot_offset)) {
+                    if (admitCall(lane, slot_offset)) {
+                        pending[getSlotPriority(slot_offset)].push_back(slot_offset);
+                        pending_count++;
+                        dispatch_depth_.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+                if (pending_count == 0) {
+                    waitForSubmission(lane, dispatch_pool);
+                    continue;
+                }
 
-                size_t shm_size = *(size_t*)(((char*)fn_call_data_shm_manager_->getMemoryPointer()) + 128);
+                for (std::deque<uint64_t>& queue : pending) {
+                    if (!queue.empty()) {
+                        slot_offset = queue.front();
+                        queue.pop_front();
+                        break;
+                    }
+                }
+                pending_count--;
+                dispatch_depth_.fetch_sub(1, std::memory_order_relaxed);
+                dispatchCall(lane, slot_offset);
+                sampleQueues(dispatch_pool);
+            }
+        }
 
-                /// Create a new shared memory manager for reading the function call data
-                SharedMemoryManager* fn_details_shm_manager = new SharedMemoryManager(shm_name, shm_size, false);
-                if (fn_details_shm_manager == NULL) {
-                    throw std::runtime_error("Failed to initialize function details data shared memory");
+        /**
+         * Publishes the depths of the submission rings and of the dispatch queues, summed over all lanes.
+         * Sampled after every dispatch, so that an idle channel reports the calls and slots left afterwards.
+         *
+         * [dispatch_pool] The pool that runs the calls, nullptr if they run on the lane listeners.
+         */
+        void sampleQueues(DispatchPool* dispatch_pool) {
+            if constexpr (Stats::ENABLED) {
+                size_t dispatch_depth = dispatch_pool ? dispatch_pool->getPendingCount()
+                    : dispatch_depth_.load(std::memory_order_relaxed);
+                size_t queue_depth = 0;
+                for (SharedMemoryRing* ring : submission_rings_) {
+                    queue_depth += ring->size();
                 }
 
-                /// Read the function call data
-                size_t offset = 0;
-                size_t call_id_len = *(size_t*)fn_details_shm_manager->getMemoryPointer(offset);
-                offset += sizeof(size_t);
+                Stats::StatsHeader* header = stats_->getHeader();
+                header->queue_depth.store(queue_depth, std::memory_order_relaxed);
+                header->dispatch_depth.store(dispatch_depth, std::memory_order_relaxed);
+                header->slot_memory.store(call_pool_->getUsedBytes(), std::memory_order_relaxed);
+            }
+        }
 
-                char* call_id = new char[call_id_len + 1];
-                fn_details_shm_manager->readData(call_id, call_id_len, offset);
-                call_id[call_id_len] = '\0';
-                offset += call_id_len;
+        /// Priority class of the call in the given slot.
+        size_t getSlotPriority(uint64_t slot_offset) {
+            return Channel::getPriority(((Channel::SlotHeader*)call_pool_->getBlockPointer(slot_offset))->frame.flags);
+        }
 
-                size_t method_name_len = *(size_t*)fn_details_shm_manager->getMemoryPointer(offset);
-                offset += sizeof(size_t);
+        /**
+         * Applies ChannelOptions::max_queue_depth and FunctionOptions::max_pending to a call taken from the ring.
+         * A call over a limit is completed as busy right away, without touching its request.
+         *
+         * Returns true if the call is admitted, it has to be run with processCall() then.
+         */
+        bool admitCall(size_t lane, uint64_t slot_offset) {
+            Channel::SlotHeader* slot = (Channel::SlotHeader*)call_pool_->getBlockPointer(slot_offset);
+            if ((slot->frame.flags & Channel::SLOT_BATCH) && stream_functions_ && hasStreamCall(slot_offset)) {
+                /// A stream needs the call slot for itself, it cannot share it with the other calls of a batch
+                failCall(slot_offset, "Streaming functions cannot be called in a batch");
+                return false;
+            }
 
-                char* method_name = new char[method_name_len + 1];
-                fn_details_shm_manager->readData(method_name, method_name_len, offset);
-                method_name[method_name_len] = '\0';
-                offset += method_name_len;
+            if (options_.max_queue_depth > 0) {
+                /// Critical calls are counted but never rejected, so that health checks pass under load
+                size_t queued = queued_calls_.fetch_add(1, std::memory_order_relaxed);
+                if (queued >= options_.max_queue_depth
+                    && Channel::getPriority(slot->frame.flags) != (size_t)CallPriority::CRITICAL) {
+                    queued_calls_.fetch_sub(1, std::memory_order_relaxed);
+                    rejectCall(lane, slot_offset, slot);
+                    return false;
+                }
+            }
 
-                std::cout << "Method name length: " << method_name_len << std::endl;
-                std::cout << "Method to execute: " << method_name << std::endl;
-                if (registered_fns_.find(method_name) == registered_fns_.end()) {
-                    throw std::runtime_error("Function not found");
+            Function* fn = getCallFunction(slot);
+            if (fn != nullptr && !fn->admit()) {
+                if (options_.max_queue_depth > 0) {
+                    queued_calls_.fetch_sub(1, std::memory_order_relaxed);
                 }
+                rejectCall(lane, slot_offset, slot);
+                return false;
+            }
+            return true;
+        }
 
-                size_t num_args = *(size_t*)fn_details_shm_manager->getMemoryPointer(offset);
-                offset += sizeof(size_t);
+        void rejectCall(size_t lane, uint64_t slot_offset, Channel::SlotHeader* slot) {
+            Log::write<Log::INFO>("Rejecting call ", slot->frame.request_id, ", the registry is busy");
+            slot->reply_offset = 0;
+            slot->reply_block = 0;
+            slot->reply_size = Channel::RETURN_BUSY;
+            if constexpr (Stats::ENABLED) {
+                Stats::add(stats_->getThread(lane)->rejected, 1);
+            }
+            completeCall(slot_offset, slot);
+        }
 
-                std::vector<std::any> args;
-                for (size_t i = 0; i < num_args; i++) {
-                    size_t arg_len = *(size_t*)fn_details_shm_manager->getMemoryPointer(offset);
-                    offset += sizeof(size_t);
+        /// Completes the call in the given slot as failed with the given message, without running it.
+        void failCall(uint64_t slot_offset, std::string_view message) {
+            Channel::SlotHeader* slot = (Channel::SlotHeader*)call_pool_->getBlockPointer(slot_offset);
+            Log::write<Log::INFO>("Failing call ", slot->frame.request_id, ": ", message);
+            SlotReplyBuffer reply(call_pool_, slot_offset, call_pool_->getBlockSize(slot_offset));
+            reply.fail(message);
+            completeCall(slot_offset, slot);
+        }
 
-                    char* arg_data = new char[arg_len + 1];
-                    fn_details_shm_manager->readData(arg_data, arg_len, offset);
-                    arg_data[arg_len] = '\0';
-                    offset += arg_len;
+        /// True if the batch in the given slot calls a streaming function, false if its framing is broken.
+        bool hasStreamCall(uint64_t slot_offset) {
+            bool stream = false;
+            try {
+                forEachBatchMethod(slot_offset, [this, &stream](uint16_t method_id) {
+                    stream |= method_id < dispatch_table_.size() && dispatch_table_[method_id]->isStream();
+                    });
+            }
+            catch (const std::exception&) {
+                /// processCall() fails the batch when it decodes it
+            }
+            return stream;
+        }
 
-                    std::string arg_type = getArgType(method_name, i);
-                    if (arg_type == typeid(std::string).name()) {
-                        args.push_back(std::string(arg_data, arg_len));
-                    }
-                    else if (arg_type == typeid(int).name()) {
-                        args.push_back(*(int*)arg_data);
+        /// Calls visit with the method ID of every call of the batch in the given slot, throws on a broken framing.
+        template <typename Visit>
+        void forEachBatchMethod(uint64_t slot_offset, Visit visit) {
+            Channel::SlotHeader* slot = (Channel::SlotHeader*)call_pool_->getBlockPointer(slot_offset);
+            size_t slot_size = call_pool_->getBlockSize(slot_offset);
+            BufferReader request((const char*)(slot + 1),
+                std::min<size_t>(slot->frame.payload_size, slot_size - sizeof(Channel::SlotHeader)));
+            uint32_t call_count = Codec<uint32_t>::decode(request);
+            for (uint32_t i = 0; i < call_count; i++) {
+                uint64_t call_size = request.readVarint();
+                BufferReader call(request.read(call_size), call_size);
+                visit(Codec<uint16_t>::decode(call));
+            }
+        }
+
+        /// Function of the call in the given slot, nullptr for a batch or an unknown method ID.
+        Function* getCallFunction(const Channel::SlotHeader* slot) const {
+            if ((slot->frame.flags & Channel::SLOT_BATCH) || slot->frame.method_id >= dispatch_table_.size()) {
+                return nullptr;
+            }
+            return dispatch_table_[slot->frame.method_id];
+        }
+
+        /**
+         * Pins the calling thread to the CPU of the given lane, modulo the number of CPUs it may run on.
+         */
+        static void pinToCpu(size_t lane) {
+            cpu_set_t allowed;
+            if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+                return;
+            }
+
+            /// The lane-th allowed CPU, wrapping around
+            size_t index = lane % CPU_COUNT(&allowed);
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &allowed) && index-- == 0) {
+                    cpu_set_t pinned;
+                    CPU_ZERO(&pinned);
+                    CPU_SET(cpu, &pinned);
+                    pthread_setaffinity_np(pthread_self(), sizeof(pinned), &pinned);
+                    return;
+                }
+            }
+        }
+
+        /**
+         * Places the return value of a call after the request in its slot, or in a separate block of the pool
+         * when it does not fit there.
+         */
+        class SlotReplyBuffer : public ReplyBuffer {
+        public:
+            SlotReplyBuffer(SharedMemoryPool* pool, size_t slot_offset, size_t slot_size)
+                : pool_(pool), slot_offset_(slot_offset), slot_size_(slot_size) {
+                slot_ = (Channel::SlotHeader*)pool_->getBlockPointer(slot_offset_);
+                slot_->reply_offset = 0;
+                slot_->reply_size = 0;
+                slot_->reply_block = 0;
+            }
+
+            BufferWriter reserve(size_t size) override {
+                if (failed_) {
+                    return BufferWriter(nullptr, 0);
+                }
+
+                size_t reply_offset = Channel::getReplyOffset(slot_);
+                if (reply_offset <= slot_size_ && size <= slot_size_ - reply_offset) {
+                    slot_->reply_offset = slot_offset_ + reply_offset;
+                    slot_->reply_size = size;
+                    return BufferWriter((char*)slot_ + reply_offset, size);
+                }
+
+                /// The invoker releases the block together with the slot, the block may exceed the memory cap since
+                /// waiting for memory here could wait for the very calls that wait for this one
+                size_t block_offset = pool_->allocate(size, false);
+                if (block_offset == SharedMemoryPool::npos) {
+                    slot_->reply_size = Channel::RETURN_OVERFLOW;
+                    return BufferWriter(nullptr, 0);
+                }
+
+                slot_->reply_block = block_offset;
+                slot_->reply_offset = block_offset;
+                slot_->reply_size = size;
+                return BufferWriter((char*)pool_->getBlockPointer(block_offset), size);
+            }
+
+            size_t getChunkCapacity() const override {
+                size_t reply_offset = Channel::getReplyOffset(slot_);
+                return reply_offset < slot_size_ ? slot_size_ - reply_offset : 0;
+            }
+
+            bool isChunkPending() const override {
+                return slot_->state.load(std::memory_order_acquire) & Channel::SLOT_ITEMS;
+            }
+
+            bool waitChunkConsumed() override {
+                uint32_t state = slot_->state.load(std::memory_order_acquire);
+                while (true) {
+                    if (state & Channel::SLOT_ABANDONED) {
+                        return false;
                     }
-                    else if (arg_type == typeid(double).name()) {
-                        args.push_back(*(double*)arg_data);
+                    if (!(state & Channel::SLOT_ITEMS)) {
+                        return true;
                     }
-                    else if (arg_type == typeid(float).name()) {
-                        args.push_back(*(float*)arg_data);
+
+                    /// The invoker wakes a flagged slot once it took the chunk or gives up on the call
+                    if (!(state & Channel::SLOT_SERVER_WAITING)) {
+                        if (!slot_->state.compare_exchange_weak(state, state | Channel::SLOT_SERVER_WAITING,
+                            std::memory_order_acq_rel, std::memory_order_acquire)) {
+                            continue;
+                        }
+                        state |= Channel::SLOT_SERVER_WAITING;
                     }
-                    else if (arg_type == typeid(bool).name()) {
-                        args.push_back(*(bool*)arg_data);
+
+                    /// Bounded park, the slot state is checked again after every slice
+                    timespec timeout = { 0, CHUNK_WAIT_SLICE_NS };
+                    Futex::wait(&slot_->state, state, &timeout);
+                    state = slot_->state.load(std::memory_order_acquire);
+                }
+            }
+
+            bool publishChunk(const char* data, size_t size) override {
+                if (failed_ || !waitChunkConsumed()) {
+                    return false;
+                }
+
+                size_t reply_offset = Channel::getReplyOffset(slot_);
+                memcpy((char*)slot_ + reply_offset, data, size);
+                slot_->reply_offset = slot_offset_ + reply_offset;
+                slot_->reply_size = size;
+
+                uint32_t state = slot_->state.fetch_or(Channel::SLOT_ITEMS, std::memory_order_acq_rel);
+                if (state & Channel::SLOT_ABANDONED) {
+                    return false;
+                }
+                if (state & Channel::SLOT_WAITING) {
+                    Futex::wake(&slot_->state);
+                }
+                return true;
+            }
+
+            /// The message is placed after the request like a return value, truncated to the room left in the slot.
+            void fail(std::string_view message) override {
+                if (failed_) {
+                    return;
+                }
+                failed_ = true;
+
+                /// A streamed chunk the invoker did not take yet occupies the same room
+                if (!waitChunkConsumed()) {
+                    return;
+                }
+
+                size_t reply_offset = Channel::getReplyOffset(slot_);
+                size_t room = reply_offset < slot_size_ ? slot_size_ - reply_offset : 0;
+                slot_->reply_offset = 0;
+                if (room > 0) {
+                    message = message.substr(0, room - varintSize(room));
+                    BufferWriter writer((char*)slot_ + reply_offset, room);
+                    Codec<std::string>::encode(writer, message);
+                    slot_->reply_offset = slot_offset_ + reply_offset;
+                }
+                slot_->reply_size = Channel::RETURN_ERROR;
+            }
+
+        private:
+            static constexpr long CHUNK_WAIT_SLICE_NS = 100000000;
+
+            SharedMemoryPool* pool_;
+            Channel::SlotHeader* slot_;
+            size_t slot_offset_;
+            size_t slot_size_;
+
+            /// Set by fail(), the return value written afterwards is dropped.
+            bool failed_ = false;
+        };
+
+        /**
+         * Collects the return values of the calls of a batch. Every return value is prefixed by a varint of its
+         * size shifted left by one, the low bit marks a failed call whose entry holds the error message instead.
+         */
+        class BatchReplyBuffer : public ReplyBuffer {
+        public:
+            /// Starts the entry of the next call of the batch.
+            void beginCall() {
+                call_offset_ = data_.size();
+                call_failed_ = false;
+            }
+
+            /// Ends the entry of the current call, a call that wrote no return value gets an empty one.
+            void endCall() {
+                if (!call_failed_ && data_.size() == call_offset_) {
+                    reserve(0);
+                }
+            }
+
+            BufferWriter reserve(size_t size) override {
+                if (call_failed_) {
+                    return BufferWriter(nullptr, 0);
+                }
+                return append(size << 1, size);
+            }
+
+            void fail(std::string_view message) override {
+                data_.resize(call_offset_);
+                call_failed_ = true;
+                BufferWriter writer = append((message.size() << 1) | 1, message.size());
+                writer.write(message.data(), message.size());
+            }
+
+            const std::vector<char>& getData() const {
+                return data_;
+            }
+
+        private:
+            BufferWriter append(uint64_t prefix, size_t size) {
+                size_t offset = data_.size();
+                size_t prefix_size = varintSize(prefix);
+                data_.resize(offset + prefix_size + size);
+
+                BufferWriter writer(data_.data() + offset, prefix_size);
+                writer.writeVarint(prefix);
+                return BufferWriter(data_.data() + offset + prefix_size, size);
+            }
+
+            std::vector<char> data_;
+            size_t call_offset_ = 0;
+            bool call_failed_ = false;
+        };
+
+        /**
+         * Decodes the call in the given slot, invokes the function and writes the response into the slot.
+         *
+         * This runs on the listening thread or on a worker of the dispatch pool, no lock is held while the
+         * registered function runs.
+         *
+         * [thread] Index of the calling dispatch thread, selects its stats cell.
+         */
+        void processCall(size_t thread, uint64_t slot_offset) {
+            Channel::SlotHeader* slot = (Channel::SlotHeader*)call_pool_->getBlockPointer(slot_offset);
+            size_t slot_size = call_pool_->getBlockSize(slot_offset);
+            if (options_.max_queue_depth > 0) {
+                queued_calls_.fetch_sub(1, std::memory_order_relaxed);
+            }
+
+            /// Read the function call data in place from the slot in the channel arena
+            BufferReader request((const char*)(slot + 1),
+                std::min<size_t>(slot->frame.payload_size, slot_size - sizeof(Channel::SlotHeader)));
+
+            SlotReplyBuffer reply(call_pool_, slot_offset, slot_size);
+            if (slot->deadline_ns != 0
+                && Channel::getDeadlineNs(std::chrono::steady_clock::now()) >= slot->deadline_ns) {
+                /// The invoker gives up on the call at its deadline anyway, running it would only delay the others
+                Log::write<Log::INFO>("Skipping expired call ", slot->frame.request_id);
+                slot->reply_size = Channel::RETURN_EXPIRED;
+                if constexpr (Stats::ENABLED) {
+                    Stats::add(stats_->getThread(thread)->expired, 1);
+                }
+            }
+            else {
+                /// An exception of the function or of a malformed call fails this call only, never the dispatch thread
+                runCall(thread, slot, request, reply);
+            }
+
+            /// Read before the completion, the invoker may reuse the slot right after it
+            if (Function* fn = getCallFunction(slot)) {
+                fn->finish();
+            }
+            completeCall(slot_offset, slot);
+        }
+
+        /**
+         * Runs an admitted call once the non reentrant functions it calls are free, see SerialQueue. A call that
+         * finds one of them busy is parked, the thread that finishes the running call runs it afterwards.
+         */
+        void dispatchCall(size_t thread, uint64_t slot_offset) {
+            if (serial_queues_.empty()) {
+                processCall(thread, slot_offset);
+                return;
+            }
+
+            /// The calls this thread runs, its own one and the parked ones it hands a serial queue to
+            std::vector<SerialCall> runnable = { { slot_offset, serial_tokens_.fetch_add(1, std::memory_order_relaxed) } };
+            std::vector<uint16_t> methods;
+            while (!runnable.empty()) {
+                SerialCall call = runnable.back();
+                runnable.pop_back();
+
+                try {
+                    getSerialMethods(call.slot_offset, methods);
+                }
+                catch (const std::exception&) {
+                    /// A malformed batch is failed by processCall() without running any function
+                    methods.clear();
+                }
+                bool acquired = true;
+                for (uint16_t method_id : methods) {
+                    if (!acquireSerial(method_id, call)) {
+                        acquired = false;
+                        break;
                     }
+                }
+                if (acquired) {
+                    processCall(thread, call.slot_offset);
+                }
 
-                    delete[] arg_data;
+                /// A parked call holds no queue, so that the calls it waits for never wait for it
+                for (uint16_t method_id : methods) {
+                    releaseSerial(thread, method_id, call.token, runnable);
                 }
+            }
+        }
 
-                /// Invoke the function
-                std::any ret = invokefunction(method_name, args);
+        /// Method IDs of the non reentrant functions the call in the given slot runs, ascending and unique.
+        void getSerialMethods(uint64_t slot_offset, std::vector<uint16_t>& methods) {
+            Channel::SlotHeader* slot = (Channel::SlotHeader*)call_pool_->getBlockPointer(slot_offset);
+            methods.clear();
+            auto addMethod = [this, &methods](uint16_t method_id) {
+                if (method_id < serial_queues_.size() && serial_queues_[method_id]) {
+                    methods.push_back(method_id);
+                }
+                };
 
-                std::string ret_value_shm_name = std::string(call_id) + "_ret";
+            if (!(slot->frame.flags & Channel::SLOT_BATCH)) {
+                addMethod(slot->frame.method_id);
+                return;
+            }
 
-                /// Write the return value to the shared memory
-                SharedMemoryManager return_size_shm_manager(
-                    (std::string(call_id) + "_ret_size").c_str(), sizeof(size_t), true);
-                size_t* ret_size = (size_t*)(return_size_shm_manager.getMemoryPointer());
-                if (ret.type().name() == typeid(std::string).name()) {
-                    std::string ret_str = std::any_cast<std::string>(ret);
-                    *ret_size = ret_str.size();
+            forEachBatchMethod(slot_offset, addMethod);
+            std::sort(methods.begin(), methods.end());
+            methods.erase(std::unique(methods.begin(), methods.end()), methods.end());
+        }
 
-                    SharedMemoryManager ret_shm_manager(ret_value_shm_name.c_str(), *ret_size, true);
-                    ret_shm_manager.writeData(ret_str.c_str(), ret_str.size());
+        /// Takes the serial queue of a function for the call, or parks the call in it if another call owns it.
+        bool acquireSerial(uint16_t method_id, const SerialCall& call) {
+            SerialQueue& queue = *serial_queues_[method_id];
+            std::lock_guard<std::mutex> lock(queue.mtx);
+            if (!queue.running) {
+                queue.running = true;
+                queue.owner = call.token;
+                return true;
+            }
+            if (queue.owner == call.token) {
+                /// Handed over by the previous owner
+                return true;
+            }
+
+            queue.parked[getSlotPriority(call.slot_offset)].push_back(
+                { call.slot_offset, call.token, std::chrono::steady_clock::now() });
+            return false;
+        }
+
+        /**
+         * Gives up the serial queue of a function if the call owns it, hands it to the oldest parked call of the
+         * highest priority class and adds that call to the runnable calls.
+         */
+        void releaseSerial(size_t thread, uint16_t method_id, uint64_t token, std::vector<SerialCall>& runnable) {
+            SerialQueue& queue = *serial_queues_[method_id];
+            SerialCall next;
+            {
+                std::lock_guard<std::mutex> lock(queue.mtx);
+                if (!queue.running || queue.owner != token) {
+                    return;
                 }
-                else if (ret.type().name() == typeid(int).name()) {
-                    *ret_size = sizeof(int);
 
-                    SharedMemoryManager ret_shm_manager(ret_value_shm_name.c_str(), *ret_size, true);
-                    *((int*)ret_shm_manager.getMemoryPointer()) = std::any_cast<int>(ret);
+                auto parked = std::find_if(std::begin(queue.parked), std::end(queue.parked),
+                    [](const std::deque<SerialCall>& calls) { return !calls.empty(); });
+                if (parked == std::end(queue.parked)) {
+                    queue.running = false;
+                    return;
                 }
-                else if (ret.type().name() == typeid(double).name()) {
-                    *ret_size = sizeof(double);
+                next = parked->front();
+                parked->pop_front();
+                queue.owner = next.token;
+            }
 
-                    SharedMemoryManager ret_shm_manager(ret_value_shm_name.c_str(), *ret_size, true);
-                    *((double*)ret_shm_manager.getMemoryPointer()) = std::any_cast<double>(ret);
+            if constexpr (Stats::ENABLED) {
+                Stats::add(stats_->getFunction(thread, method_id)->lock_wait_ns,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - next.parked_at).count());
+            }
+            runnable.push_back(next);
+        }
+
+        /**
+         * Completes the call in the given slot, the slot is released by the invoker after reading the response.
+         */
+        void completeCall(uint64_t slot_offset, Channel::SlotHeader* slot) {
+            uint32_t state = slot->state.exchange(Channel::SLOT_COMPLETED, std::memory_order_acq_rel);
+            if (state & Channel::SLOT_ABANDONED) {
+                /// Nobody reads the response anymore
+                Log::write<Log::INFO>("Releasing abandoned call ", slot->frame.request_id);
+                if (slot->reply_block != 0) {
+                    call_pool_->release(slot->reply_block);
+                }
+                call_pool_->release(slot_offset);
+            }
+            else {
+                if (state & Channel::SLOT_WAITING) {
+                    /// Only the invoker parked on this slot is woken
+                    Futex::wake(&slot->state);
                 }
-                else if (ret.type().name() == typeid(float).name()) {
-                    *ret_size = sizeof(float);
+                if (state & Channel::SLOT_NOTIFY) {
+                    /// The completion threads share the word, each checks its own awaited slots
+                    channel_header_->completions.fetch_add(1, std::memory_order_release);
+                    Futex::wakeAll(&channel_header_->completions);
+                }
+            }
+        }
 
-                    SharedMemoryManager ret_shm_manager(ret_value_shm_name.c_str(), *ret_size, true);
-                    *((float*)ret_shm_manager.getMemoryPointer()) = std::any_cast<float>(ret);
+        /**
+         * Runs a single call or the calls of a batch, a call that throws is failed with the message of the
+         * exception instead of a return value.
+         */
+        void runCall(size_t thread, Channel::SlotHeader* slot, BufferReader& request, SlotReplyBuffer& reply) {
+            try {
+                if (!(slot->frame.flags & Channel::SLOT_BATCH)) {
+                    runOrFail(thread, slot->frame.request_id, slot->frame.method_id, request, reply);
+                    return;
                 }
-                else if (ret.type().name() == typeid(bool).name()) {
-                    *ret_size = sizeof(bool);
 
-                    SharedMemoryManager ret_shm_manager(ret_value_shm_name.c_str(), *ret_size, true);
-                    *((bool*)ret_shm_manager.getMemoryPointer()) = std::any_cast<bool>(ret);
+                /// Run the calls of the batch in order, their return values are posted with a single completion
+                BatchReplyBuffer batch_reply;
+                uint32_t call_count = Codec<uint32_t>::decode(request);
+                for (uint32_t i = 0; i < call_count; i++) {
+                    uint64_t call_size = request.readVarint();
+                    BufferReader call(request.read(call_size), call_size);
+                    uint16_t method_id = Codec<uint16_t>::decode(call);
+
+                    batch_reply.beginCall();
+                    runOrFail(thread, slot->frame.request_id, method_id, call, batch_reply);
+                    batch_reply.endCall();
                 }
-                else {
-                    /// Void return type
-                    *ret_size = 0;
+
+                const std::vector<char>& data = batch_reply.getData();
+                BufferWriter writer = reply.reserve(data.size());
+                writer.write(data.data(), data.size());
+            }
+            catch (const std::exception& e) {
+                /// The framing of the batch itself is broken
+                Log::write<Log::ERROR>("Call ", slot->frame.request_id, " failed: ", e.what());
+                reply.fail(e.what());
+            }
+            catch (...) {
+                Log::write<Log::ERROR>("Call ", slot->frame.request_id, " failed with an unknown exception");
+                reply.fail("Unknown exception");
+            }
+        }
+
+        /// Runs a call with invokeCall() and fails its reply if it throws.
+        void runOrFail(size_t thread, uint64_t request_id, uint16_t method_id, BufferReader& request,
+            ReplyBuffer& reply) {
+            try {
+                invokeCall(thread, method_id, request, reply);
+            }
+            catch (const std::exception& e) {
+                Log::write<Log::ERROR>("Call ", request_id, " failed: ", e.what());
+                reply.fail(e.what());
+            }
+            catch (...) {
+                Log::write<Log::ERROR>("Call ", request_id, " failed with an unknown exception");
+                reply.fail("Unknown exception");
+            }
+        }
+
+        /**
+         * Dispatches a single call to its function and writes the return value into the reply buffer.
+         *
+         * The arguments are not checked against the signature, the invoker has compared the schema hash of the
+         * function before sending the call.
+         */
+        void invokeCall(size_t thread, uint16_t method_id, BufferReader& request, ReplyBuffer& reply) {
+            if (method_id >= dispatch_table_.size()) {
+                throw std::runtime_error("Function not found");
+            }
+            Function* fn = dispatch_table_[method_id];
+
+            Log::write<Log::DEBUG>("Method to execute: ", fn->getName());
+
+            /// Invoke the function, view arguments point into the request which stays untouched until it returns
+            if constexpr (Stats::ENABLED) {
+                Stats::FunctionStats* stats = stats_->getFunction(thread, method_id);
+                Stats::add(stats->started, 1);
+
+                bool cache_hit = false;
+                auto start = std::chrono::steady_clock::now();
+                try {
+                    fn->invoke(request, reply, &cache_hit);
+                }
+                catch (...) {
+                    Stats::add(stats->completed, 1);
+                    throw;
+                }
+                uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+
+                Stats::add(stats->total_ns, ns);
+                if (fn->getCache() != nullptr) {
+                    Stats::add(cache_hit ? stats->cache_hits : stats->cache_misses, 1);
                 }
+                Stats::add(stats->histogram[Stats::getHistogramBucket(ns)], 1);
+                Stats::add(stats->completed, 1);
+            }
+            else {
+                fn->invoke(request, reply);
+            }
+        }
 
-                /// Reset the function call data
-                memset(fn_call_data_shm_manager_->getMemoryPointer(), 0, FUNCTION_CALL_DATA_SHM_SIZE);
+        /**
+         * Waits until the submission ring of the lane holds at least one call slot.
+         */
+        void waitForSubmission(size_t lane, DispatchPool* dispatch_pool) {
+            SharedMemoryRing* submission_ring = submission_rings_[lane];
+            if (submission_spin_.spinUntil([submission_ring] { return !submission_ring->empty(); })) {
+                return;
+            }
 
-                delete[] shm_name;
-                fn_details_shm_manager->removeMemory();
-                delete fn_details_shm_manager;
+            Log::write<Log::DEBUG>("Waiting for signal on lane ", lane, "...");
+            auto start = std::chrono::steady_clock::now();
 
-                pthread_cond_broadcast(cv_);
-                pthread_mutex_unlock(mtx_);
+            /// Announce that the listener is about to park so that the next invoker rings the doorbell
+            Channel::LaneHeader* lane_header = lane_headers_[lane];
+            uint32_t doorbell = lane_header->doorbell.load(std::memory_order_acquire);
+            lane_header->server_waiting.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            sampleQueues(dispatch_pool);
+            bool idle_sampled = !Stats::ENABLED;
+            while (submission_ring->empty() && !stopping_.load(std::memory_order_relaxed)) {
+                if (idle_sampled) {
+                    Futex::wait(&lane_header->doorbell, doorbell);
+                }
+                else {
+                    /// The invokers may still read the replies of the last calls, sample again once they are done
+                    timespec timeout = { 0, Stats::IDLE_SAMPLE_NS };
+                    if (!Futex::wait(&lane_header->doorbell, doorbell, &timeout)) {
+                        sampleQueues(dispatch_pool);
+                        idle_sampled = true;
+                    }
+                }
+                doorbell = lane_header->doorbell.load(std::memory_order_acquire);
             }
+            lane_header->server_waiting.store(0, std::memory_order_relaxed);
+
+            if constexpr (Stats::ENABLED) {
+                Stats::ThreadStats* stats = stats_->getThread(lane);
+                Stats::add(stats->parks, 1);
+                Stats::add(stats->park_ns, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+            }
+
+            Log::write<Log::DEBUG>("Doorbell signal received");
         }
-    private:
+
         /**
-         * Calls a function with the given name and arguments.
+         * Returns the registered function with the given name.
+         * If the function is not registered, then it throws a runtime error.
          */
-        std::any invokefunction(std::string name, const std::vector<std::any>& args) {
-            if (registered_fns_.find(name) == registered_fns_.end()) {
+        Function* findFunction(std::string_view name) {
+            auto fn = registered_fns_.find(name);
+            if (fn == registered_fns_.end()) {
                 throw std::runtime_error("Function not found");
             }
 
-            return registered_fns_.at(name)->invoke(args);
+            return fn->second;
         }
 
         /**
@@ -280,12 +1054,8 @@ namespace IPC {
          *
          * [name] The name of the function.
          */
-        int getArgCount(std::string name) {
-            if (registered_fns_.find(name) == registered_fns_.end()) {
-                throw std::runtime_error("Function not found");
-            }
-
-            return registered_fns_.at(name)->getArgCount();
+        int getArgCount(std::string_view name) {
+            return findFunction(name)->getArgCount();
         }
 
         /**
@@ -294,12 +1064,8 @@ namespace IPC {
          * [name] The name of the function.
          * [index] The index of the argument.
          */
-        std::string getArgType(std::string name, int index) {
-            if (registered_fns_.find(name) == registered_fns_.end()) {
-                throw std::runtime_error("Function not found");
-            }
-
-            return registered_fns_.at(name)->getArgType(index);
+        std::string getArgType(std::string_view name, int index) {
+            return findFunction(name)->getArgType(index);
         }
 
         /**
@@ -315,7 +1081,17 @@ namespace IPC {
          * All registered functions are stored in a map with the function name as the key.
          * The value is the Function object that wraps the function.
          */
-        std::map<std::string, IPC::Function*> registered_fns_;
+        std::map<std::string, IPC::Function*, std::less<>> registered_fns_;
+
+        /**
+         * The registered functions indexed by their method IDs, filled when the registry is sealed.
+         */
+        std::vector<IPC::Function*> dispatch_table_;
+
+        /**
+         * True once the method table is published.
+         */
+        bool sealed_ = false;
 
         /**
          * The name of the registry, usually this is used for the IPC channel name (In this case
@@ -323,16 +1099,75 @@ namespace IPC {
          */
         std::string channel_name_;
 
+        /**
+         * Options of this side of the channel.
+         */
+        ChannelOptions options_;
+
+        /**
+         * Number of admitted calls that no dispatch thread started yet, only counted if
+         * ChannelOptions::max_queue_depth is set.
+         */
+        std::atomic<size_t> queued_calls_{ 0 };
+
+        /**
+         * Number of calls the lane listeners took from their rings that did not run yet, summed over all
+         * lanes. Only counted if the calls run on the lane listeners, the dispatch pool keeps its own.
+         */
+        std::atomic<size_t> dispatch_depth_{ 0 };
+
+        /**
+         * Set when a lane listener fails, makes the other listeners return, see stopListeners().
+         */
+        std::atomic<bool> stopping_{ false };
+
+        /// Serial queues by method ID, set for the non reentrant functions only, empty if there are none.
+        std::vector<std::unique_ptr<SerialQueue>> serial_queues_;
+
+        /// Source of SerialCall::token.
+        std::atomic<uint64_t> serial_tokens_{ 0 };
+
+        /// True if a streaming function is registered, only then batches are checked for stream calls.
+        bool stream_functions_ = false;
+
+        /**
+         * Spin budget for waiting on new submissions.
+         */
+        AdaptiveSpin submission_spin_;
+
         /**
          * Shared memory used to store the function registry data.
          */
-        SharedMemoryManager* sync_shm_manager_;
         SharedMemoryManager* fn_call_data_shm_manager_;
 
         /**
-         * The mutex and the condition variable are used to synchronize access to the registry.
+         * Header of the channel, holds the completion word of the awaited calls.
+         */
+        Channel::ChannelHeader* channel_header_;
+
+        /**
+         * Headers of the lanes of the channel, indexed by lane.
+         */
+        std::vector<Channel::LaneHeader*> lane_headers_;
+
+        /**
+         * Method table published to the invokers.
+         */
+        Channel::MethodTableHeader* method_table_;
+
+        /**
+         * Rings of submitted call slots indexed by lane, the listener of the lane is the only consumer.
+         */
+        std::vector<SharedMemoryRing*> submission_rings_;
+
+        /**
+         * Pool of request/response slots inside the function call data shared memory.
+         */
+        SharedMemoryPool* call_pool_;
+
+        /**
+         * Published call statistics, created when the registry starts listening.
          */
-        pthread_mutex_t* mtx_;
-        pthread_cond_t* cv_;
+        std::unique_ptr<ChannelStats> stats_;
     };
 }
\ No newline at end of file
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <shm_manager/shm_manager.h>
+
+/// Set to 0 to compile the call counters and latency histograms out of the registry.
+#ifndef FUNCTION_CALL_STATS
+#define FUNCTION_CALL_STATS 1
+#endif
+
+namespace IPC {
+    /**
+     * Statistics of a registry, published in their own shared memory segment ("<channel name>-stats") so that
+     * an external tool can read them with a StatsReader without touching the channel or the registry.
+     *
+     * Every dispatch thread (the listener and every worker) owns a cache line aligned cell and is its only
+     * writer, so the counters are updated without atomic read-modify-write operations. Readers add the cells up.
+     *
+     * STATS SHARED MEMORY STRUCTURE DETAILS
+     * 1. Stats header (StatsHeader, one cache line)
+     * 2. Function names (method_count x NAME_SIZE bytes, indexed by method ID)
+     * 3. Thread cells (thread_count x getCellSize(method_count) bytes), every cell holds:
+     *    a. ThreadStats
+     *    b. FunctionStats of every function, indexed by method ID
+     */
+    namespace Stats {
+        constexpr bool ENABLED = FUNCTION_CALL_STATS != 0;
+
+        constexpr size_t CACHE_LINE_SIZE = 64;
+        constexpr uint64_t MAGIC = 0x7374617473637066; // "fpcstats"
+        constexpr uint32_t VERSION = 5;
+
+        /// Bucket i counts the calls that took 2^i to 2^(i + 1) - 1 nanoseconds, the last bucket is open ended.
+        constexpr size_t HISTOGRAM_BUCKETS = 40;
+
+        /// Size of a function name entry, longer names are truncated.
+        constexpr size_t NAME_SIZE = 64;
+
+        /// A parked listener samples the queue gauges again once its lane stayed idle this long, after the
+        /// invokers released the slots of their last calls.
+        constexpr long IDLE_SAMPLE_NS = 100000000;
+
+        struct alignas(CACHE_LINE_SIZE) StatsHeader {
+            /// MAGIC once the header is written.
+            std::atomic<uint64_t> magic;
+            uint32_t version;
+            uint32_t method_count;
+            uint32_t thread_count;
+            uint32_t reserved;
+
+            /// Number of submitted calls waiting in the submission ring, summed over all lanes.
+            std::atomic<uint64_t> queue_depth;
+
+            /// Number of calls taken from the rings that did not run yet, summed over all lanes.
+            std::atomic<uint64_t> dispatch_depth;
+
+            /// Number of bytes of call slots in use, sampled after every dispatch.
+            std::atomic<uint64_t> slot_memory;
+        };
+
+        struct alignas(CACHE_LINE_SIZE) ThreadStats {
+            /// Number of times the thread parked waiting for calls and the time it spent parked.
+            std::atomic<uint64_t> parks;
+            std::atomic<uint64_t> park_ns;
+
+            /// Number of calls skipped because their deadline passed while they were queued.
+            std::atomic<uint64_t> expired;
+
+            /// Number of calls rejected as busy by the queue limits.
+            std::atomic<uint64_t> rejected;
+        };
+
+        struct alignas(CACHE_LINE_SIZE) FunctionStats {
+            /// started - completed is the number of calls currently running.
+            std::atomic<uint64_t> started;
+            std::atomic<uint64_t> completed;
+
+            /// Time spent in the function.
+            std::atomic<uint64_t> total_ns;
+
+            /// Time calls of a non reentrant function spent parked while another call of it ran.
+            std::atomic<uint64_t> lock_wait_ns;
+
+            /// Calls of a cached function answered from its result cache, and the ones that ran the function.
+            std::atomic<uint64_t> cache_hits;
+            std::atomic<uint64_t> cache_misses;
+
+            std::atomic<uint64_t> histogram[HISTOGRAM_BUCKETS];
+        };
+
+        inline size_t getCellSize(size_t method_count) {
+            return sizeof(ThreadStats) + sizeof(FunctionStats) * method_count;
+        }
+
+        inline size_t getCellsOffset(size_t method_count) {
+            return (sizeof(StatsHeader) + NAME_SIZE * method_count + CACHE_LINE_SIZE - 1)
+                / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+        }
+
+        /// Total size of the stats shared memory.
+        inline size_t getShmSize(size_t method_count, size_t thread_count) {
+            return getCellsOffset(method_count) + getCellSize(method_count) * thread_count;
+        }
+
+        /// Name of the stats shared memory of a channel.
+        inline std::string getShmName(const std::string& channel_name) {
+            return channel_name + "-stats";
+        }
+
+        /// Adds to a counter of the calling thread's own cell, no other thread writes it.
+        inline void add(std::atomic<uint64_t>& counter, uint64_t value) {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+        inline size_t getHistogramBucket(uint64_t ns) {
+            size_t bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+            return std::min(bucket, HISTOGRAM_BUCKETS - 1);
+        }
+    }
+
+    /**
+     * Writer side of the statistics, owned by the registry while it listens.
+     */
+    class ChannelStats {
+    public:
+        /**
+         * [names] Names of the registered functions, indexed by method ID.
+         * [thread_count] Number of dispatch threads, each one writes its own cell.
+         */
+        ChannelStats(const std::string& channel_name, const std::vector<std::string>& names, size_t thread_count)
+            : method_count_(names.size()) {
+            shm_ = new SharedMemoryManager(Stats::getShmName(channel_name),
+                Stats::getShmSize(names.size(), thread_count), true);
+
+            /// The segment is always created anew, a stale one of a registry that did not shut down is unlinked
+            /// first, so every counter and name entry starts zeroed
+            char* name_entries = (char*)shm_->getMemoryPointer(sizeof(Stats::StatsHeader));
+            for (size_t i = 0; i < names.size(); i++) {
+                strncpy(name_entries + i * Stats::NAME_SIZE, names[i].c_str(), Stats::NAME_SIZE - 1);
+            }
+
+            cells_ = (char*)shm_->getMemoryPointer(Stats::getCellsOffset(method_count_));
+
+            header_ = (Stats::StatsHeader*)shm_->getMemoryPointer();
+            header_->method_count = names.size();
+            header_->thread_count = thread_count;
+            header_->version = Stats::VERSION;
+            header_->magic.store(Stats::MAGIC, std::memory_order_release);
+        }
+
+        ~ChannelStats() {
+            shm_->removeMemory();
+            delete shm_;
+        }
+
+        ChannelStats(const ChannelStats&) = delete;
+        ChannelStats& operator=(const ChannelStats&) = delete;
+
+        Stats::StatsHeader* getHeader() {
+            return header_;
+        }
+
+        Stats::ThreadStats* getThread(size_t thread) {
+            return (Stats::ThreadStats*)(cells_ + Stats::getCellSize(method_count_) * thread);
+        }
+
+        Stats::FunctionStats* getFunction(size_t thread, uint32_t method_id) {
+            return (Stats::FunctionStats*)(getThread(thread) + 1) + method_id;
+        }
+
+    private:
+        SharedMemoryManager* shm_;
+        Stats::StatsHeader* header_;
+        char* cells_;
+        size_t method_count_;
+    };
+
+    /**
+     * Statistics of a single function, summed up over all dispatch threads.
+     */
+    struct FunctionStatsSnapshot {
+        std::string name;
+        uint64_t calls = 0;
+        uint64_t in_flight = 0;
+        uint64_t total_ns = 0;
+        uint64_t lock_wait_ns = 0;
+        uint64_t cache_hits = 0;
+        uint64_t cache_misses = 0;
+        std::vector<uint64_t> histogram = std::vector<uint64_t>(Stats::HISTOGRAM_BUCKETS, 0);
+    };
+
+    struct StatsSnapshot {
+        uint64_t queue_depth = 0;
+        uint64_t dispatch_depth = 0;
+        uint64_t slot_memory = 0;
+        uint64_t parks = 0;
+        uint64_t park_ns = 0;
+        uint64_t expired = 0;
+        uint64_t rejected = 0;
+        std::vector<FunctionStatsSnapshot> functions;
+    };
+
+    /**
+     * Reads the statistics of a channel from another process. The stats shared memory is mapped read only,
+     * so reading never disturbs the registry.
+     */
+    class StatsReader {
+    public:
+        StatsReader(const std::string& channel_name) {
+            shm_ = new SharedMemoryManager(Stats::getShmName(channel_name), 0, false, true);
+
+            header_ = (const Stats::StatsHeader*)shm_->getMemoryPointer();
+            if (shm_->getSize() < sizeof(Stats::StatsHeader)
+                || header_->magic.load(std::memory_order_acquire) != Stats::MAGIC
+                || header_->version != Stats::VERSION
+                || shm_->getSize() < Stats::getShmSize(header_->method_count, header_->thread_count)) {
+                delete shm_;
+                throw std::runtime_error("Invalid function call stats shared memory");
+            }
+        }
+
+        ~StatsReader() {
+            delete shm_;
+        }
+
+        StatsReader(const StatsReader&) = delete;
+        StatsReader& operator=(const StatsReader&) = delete;
+
+        /**
+         * Adds up the cells of all dispatch threads. The counters are read one by one while the registry keeps
+         * updating them, so the snapshot is not atomic as a whole.
+         */
+        StatsSnapshot read() const {
+            size_t method_count = header_->method_count;
+            const char* names = (const char*)shm_->getMemoryPointer(sizeof(Stats::StatsHeader));
+            const char* cells = (const char*)shm_->getMemoryPointer(Stats::getCellsOffset(method_count));
+
+            StatsSnapshot snapshot;
+            snapshot.queue_depth = header_->queue_depth.load(std::memory_order_relaxed);
+            snapshot.dispatch_depth = header_->dispatch_depth.load(std::memory_order_relaxed);
+            snapshot.slot_memory = header_->slot_memory.load(std::memory_order_relaxed);
+            snapshot.functions.resize(method_count);
+            for (size_t i = 0; i < method_count; i++) {
+                snapshot.functions[i].name = std::string(names + i * Stats::NAME_SIZE,
+                    strnlen(names + i * Stats::NAME_SIZE, Stats::NAME_SIZE));
+            }
+
+            for (size_t thread = 0; thread < header_->thread_count; thread++) {
+                const Stats::ThreadStats* thread_stats =
+                    (const Stats::ThreadStats*)(cells + Stats::getCellSize(method_count) * thread);
+                snapshot.parks += thread_stats->parks.load(std::memory_order_relaxed);
+                snapshot.park_ns += thread_stats->park_ns.load(std::memory_order_relaxed);
+                snapshot.expired += thread_stats->expired.load(std::memory_order_relaxed);
+                snapshot.rejected += thread_stats->rejected.load(std::memory_order_relaxed);
+
+                const Stats::FunctionStats* function_stats = (const Stats::FunctionStats*)(thread_stats + 1);
+                for (size_t i = 0; i < method_count; i++) {
+                    FunctionStatsSnapshot& function = snapshot.functions[i];
+                    uint64_t started = function_stats[i].started.load(std::memory_order_relaxed);
+                    uint64_t completed = function_stats[i].completed.load(std::memory_order_relaxed);
+                    function.calls += completed;
+                    function.in_flight += started > completed ? started - completed : 0;
+                    function.total_ns += function_stats[i].total_ns.load(std::memory_order_relaxed);
+                    function.lock_wait_ns += function_stats[i].lock_wait_ns.load(std::memory_order_relaxed);
+                    function.cache_hits += function_stats[i].cache_hits.load(std::memory_order_relaxed);
+                    function.cache_misses += function_stats[i].cache_misses.load(std::memory_order_relaxed);
+                    for (size_t bucket = 0; bucket < Stats::HISTOGRAM_BUCKETS; bucket++) {
+                        function.histogram[bucket] += function_stats[i].histogram[bucket].load(std::memory_order_relaxed);
+                    }
+                }
+            }
+            return snapshot;
+        }
+
+    private:
+        SharedMemoryManager* shm_;
+        const Stats::StatsHeader* header_;
+    };
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include <fn/fn_codec.h>
+
+namespace IPC {
+    /**
+     * Return type tag of a streaming function in its schema, so that a function streaming T and one returning
+     * T have different SchemaHashes.
+     */
+    template <typename T>
+    struct Stream {};
+
+    /// True for the Stream<T> return type tag.
+    template <typename T>
+    inline constexpr bool is_stream_v = false;
+
+    template <typename T>
+    inline constexpr bool is_stream_v<Stream<T>> = true;
+
+    /**
+     * Maps the signature a streaming function is called with, T(Args...), to the signature of its schema,
+     * Stream<T>(Args...).
+     */
+    template <typename Signature>
+    struct StreamSignature;
+
+    template <typename T, typename... Args>
+    struct StreamSignature<T(Args...)> {
+        using type = Stream<T>(Args...);
+    };
+
+    /**
+     * Hands the items of a streaming function to the invoker while the function runs, see
+     * FunctionRegistry::registerStream().
+     *
+     * Items are encoded into chunks (every item prefixed by its size as a varint) that are passed through the
+     * call slot. An item is sent right away while the invoker keeps up, otherwise the items are collected
+     * until the invoker has taken the previous chunk, so a slow invoker gets fewer and larger chunks. Once the
+     * chunk is as large as the call slot, write() blocks until the invoker catches up.
+     */
+    template <typename T>
+    class StreamWriter {
+    public:
+        explicit StreamWriter(ReplyBuffer& reply) : reply_(reply) {}
+
+        StreamWriter(const StreamWriter&) = delete;
+        StreamWriter& operator=(const StreamWriter&) = delete;
+
+        /**
+         * Sends an item to the invoker. Returns false if the invoker gave up on the call (it was destroyed or
+         * timed out), the function should return then since nobody reads its items anymore. An item larger than
+         * the call slot fails the call, the invoker gets the error and write() returns false as well.
+         */
+        bool write(const T& item) {
+            if (cancelled_) {
+                return false;
+            }
+
+            size_t item_size = Codec<T>::size(item);
+            size_t record_size = varintSize(item_size) + item_size;
+            size_t capacity = reply_.getChunkCapacity();
+            if (capacity == 0 || record_size > capacity) {
+                /// The call fails with the error, the function sees a cancelled stream and should return
+                reply_.fail(capacity == 0 ? "Streaming functions cannot be called in a batch"
+                    : "Stream item exceeds the call slot size");
+                cancelled_ = true;
+                pending_.clear();
+                return false;
+            }
+
+            if (pending_.size() + record_size > capacity && !flush()) {
+                return false;
+            }
+
+            size_t offset = pending_.size();
+            pending_.resize(offset + record_size);
+            BufferWriter writer(pending_.data() + offset, record_size);
+            writer.writeVarint(item_size);
+            Codec<T>::encode(writer, item);
+
+            if (!reply_.isChunkPending()) {
+                return flush();
+            }
+            return true;
+        }
+
+        /// True once the invoker gave up on the call or the call failed.
+        bool isCancelled() const {
+            return cancelled_;
+        }
+
+        /**
+         * Ends the stream, the items not sent yet become the return value of the call. Called by the registry
+         * once the function returns.
+         */
+        void close() {
+            if (cancelled_ || !reply_.waitChunkConsumed()) {
+                return;
+            }
+
+            BufferWriter writer = reply_.reserve(pending_.size());
+            writer.write(pending_.data(), pending_.size());
+            pending_.clear();
+        }
+
+    private:
+        bool flush() {
+            if (!reply_.publishChunk(pending_.data(), pending_.size())) {
+                cancelled_ = true;
+            }
+            pending_.clear();
+            return !cancelled_;
+        }
+
+        ReplyBuffer& reply_;
+
+        /// Encoded items not sent yet.
+        std::vector<char> pending_;
+
+        bool cancelled_ = false;
+    };
+}
@@ -0,0 +1,103 @@
+#include <shm_manager/shm_arena.h>
+
+#include <new>
+#include <stdexcept>
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared memory arena requires lock free 64-bit atomics");
+
+IPC::SharedMemoryArena::SharedMemoryArena(SharedMemoryManager* shm, size_t offset, size_t block_size,
+    size_t block_count, bool init)
+    : shm(shm), block_size(alignUp(block_size, CACHE_LINE_SIZE)), block_count(block_count) {
+    if (block_count == 0 || block_count >= UINT32_MAX) {
+        throw std::runtime_error("Invalid shared memory arena block count.");
+    }
+
+    size_t links_offset = offset + alignUp(sizeof(ArenaHeader), CACHE_LINE_SIZE);
+    blocks_offset = alignUp(links_offset + sizeof(std::atomic<uint32_t>) * block_count, CACHE_LINE_SIZE);
+
+    /// Validates that the whole region is inside the mapping.
+    shm->getMemoryPointer(offset + requiredSize(block_size, block_count));
+
+    if (init) {
+        arena_header = new(shm->getMemoryPointer(offset)) ArenaHeader{ this->block_size, block_count, {0} };
+        free_links = (std::atomic<uint32_t>*)shm->getMemoryPointer(links_offset);
+
+        /// Chain every block into the free list, block 0 on top.
+        for (size_t i = 0; i < block_count; i++) {
+            new(&free_links[i]) std::atomic<uint32_t>(i + 1 < block_count ? i + 2 : 0);
+        }
+        arena_header->free_head.store(1, std::memory_order_release);
+    }
+    else {
+        arena_header = (ArenaHeader*)shm->getMemoryPointer(offset);
+        free_links = (std::atomic<uint32_t>*)shm->getMemoryPointer(links_offset);
+
+        if (arena_header->block_size != this->block_size || arena_header->block_count != block_count) {
+            throw std::runtime_error("Shared memory arena layout mismatch.");
+        }
+    }
+}
+
+size_t IPC::SharedMemoryArena::requiredSize(size_t block_size, size_t block_count) {
+    size_t size = alignUp(sizeof(ArenaHeader), CACHE_LINE_SIZE);
+    size = alignUp(size + sizeof(std::atomic<uint32_t>) * block_count, CACHE_LINE_SIZE);
+    return size + alignUp(block_size, CACHE_LINE_SIZE) * block_count;
+}
+
+size_t IPC::SharedMemoryArena::allocate() {
+    uint64_t head = arena_header->free_head.load(std::memory_order_acquire);
+    while (true) {
+        uint32_t top = (uint32_t)head;
+        if (top == 0) {
+            return npos;
+        }
+
+        uint64_t next = free_links[top - 1].load(std::memory_order_relaxed);
+        uint64_t new_head = (((head >> 32) + 1) << 32) | next;
+        if (arena_header->free_head.compare_exchange_weak(head, new_head,
+            std::memory_order_acq_rel, std::memory_order_acquire)) {
+            return blocks_offset + (size_t)(top - 1) * block_size;
+        }
+    }
+}
+
+void IPC::SharedMemoryArena::release(size_t block_offset) {
+    size_t index = blockIndex(block_offset);
+
+    uint64_t head = arena_header->free_head.load(std::memory_order_relaxed);
+    while (true) {
+        free_links[index].store((uint32_t)head, std::memory_order_relaxed);
+
+        uint64_t new_head = (((head >> 32) + 1) << 32) | (uint64_t)(index + 1);
+        if (arena_header->free_head.compare_exchange_weak(head, new_head,
+            std::memory_order_release, std::memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+void* IPC::SharedMemoryArena::getBlockPointer(size_t block_offset) {
+    blockIndex(block_offset);
+    return shm->getMemoryPointer(block_offset);
+}
+
+size_t IPC::SharedMemoryArena::getBlockSize() const {
+    return block_size;
+}
+
+bool IPC::SharedMemoryArena::contains(size_t block_offset) const {
+    return block_offset >= blocks_offset && (block_offset - blocks_offset) % block_size == 0
+        && (block_offset - blocks_offset) / block_size < block_count;
+}
+
+size_t IPC::SharedMemoryArena::alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+size_t IPC::SharedMemoryArena::blockIndex(size_t block_offset) const {
+    if (!contains(block_offset)) {
+        throw std::runtime_error("Invalid shared memory arena block offset.");
+    }
+
+    return (block_offset - blocks_offset) / block_size;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include <shm_manager/shm_manager.h>
+
+namespace IPC {
+    /**
+     * Sub-allocates fixed size blocks out of a region of an already mapped shared memory segment.
+     *
+     * The free list lives inside the segment itself so that every process mapping the segment
+     * allocates from and releases to the same pool. Blocks are addressed by their offset from the
+     * start of the segment since each process maps the segment at a different address.
+     *
+     * REGION STRUCTURE DETAILS
+     * 1. Arena header (block size, block count, tagged free list head)
+     * 2. Free list links (one uint32_t per block)
+     * 3. Blocks (each block is cache line aligned)
+     */
+    class SharedMemoryArena {
+    public:
+        /// Returned by allocate() when every block is in use.
+        static constexpr size_t npos = SIZE_MAX;
+
+        /**
+         * [shm] The segment that holds the arena.
+         * [offset] Offset of the arena region inside the segment.
+         * [block_size] Usable size of every block (rounded up to a cache line).
+         * [block_count] Number of blocks in the arena.
+         * [init] True for the process that creates the segment, it formats the free list.
+         */
+        SharedMemoryArena(SharedMemoryManager* shm, size_t offset, size_t block_size, size_t block_count, bool init);
+
+        /// Returns the number of bytes the arena occupies inside the segment.
+        static size_t requiredSize(size_t block_size, size_t block_count);
+
+        /// Takes a block from the free list, returns its segment offset or npos if the arena is exhausted.
+        size_t allocate();
+
+        /// Returns a block to the free list.
+        void release(size_t block_offset);
+
+        /// Get the pointer to the block at the given segment offset.
+        void* getBlockPointer(size_t block_offset);
+
+        /// Usable size of a single block.
+        size_t getBlockSize() const;
+
+        /// True if the given segment offset is the offset of one of the blocks of this arena.
+        bool contains(size_t block_offset) const;
+
+    private:
+        struct ArenaHeader {
+            uint64_t block_size;
+            uint64_t block_count;
+
+            /// Upper 32 bits hold an ABA tag, lower 32 bits hold (block index + 1), 0 means empty.
+            std::atomic<uint64_t> free_head;
+        };
+
+        static constexpr size_t CACHE_LINE_SIZE = 64;
+
+        static size_t alignUp(size_t value, size_t alignment);
+
+        size_t blockIndex(size_t block_offset) const;
+
+        SharedMemoryManager* shm;
+        ArenaHeader* arena_header;
+        std::atomic<uint32_t>* free_links;
+        size_t blocks_offset;
+        size_t block_size;
+        size_t block_count;
+    };
+}
@@ -0,0 +1,163 @@
+#include <shm_manager/shm_broadcast.h>
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#include <sync/futex.h>
+
+IPC::SharedMemoryBroadcastRing::SharedMemoryBroadcastRing(SharedMemoryManager* shm, size_t offset, size_t capacity,
+    size_t message_size, bool init)
+    : cell_stride(getCellStride(message_size)), mask(capacity - 1) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        throw std::runtime_error("Shared memory broadcast ring capacity must be a power of two.");
+    }
+    if (offset % CACHE_LINE_SIZE != 0) {
+        throw std::runtime_error("Shared memory broadcast ring must be cache line aligned.");
+    }
+
+    /// Validates that the whole region is inside the mapping.
+    shm->getMemoryPointer(offset + requiredSize(capacity, message_size));
+
+    cells = (char*)shm->getMemoryPointer(offset + sizeof(BroadcastHeader));
+    if (init) {
+        header = new(shm->getMemoryPointer(offset)) BroadcastHeader{ {0}, {0}, {0}, capacity, message_size };
+
+        /// Version 0 never matches a published message, readers skip cells that were not written yet.
+        for (size_t i = 0; i < capacity; i++) {
+            new(cells + i * cell_stride) CellHeader{ {0}, 0 };
+        }
+    }
+    else {
+        header = (BroadcastHeader*)shm->getMemoryPointer(offset);
+
+        if (header->capacity != capacity || header->message_size != message_size) {
+            throw std::runtime_error("Shared memory broadcast ring layout mismatch.");
+        }
+    }
+}
+
+size_t IPC::SharedMemoryBroadcastRing::requiredSize(size_t capacity, size_t message_size) {
+    return sizeof(BroadcastHeader) + getCellStride(message_size) * capacity;
+}
+
+size_t IPC::SharedMemoryBroadcastRing::getCellStride(size_t message_size) {
+    return (sizeof(CellHeader) + message_size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+IPC::SharedMemoryBroadcastRing::CellHeader* IPC::SharedMemoryBroadcastRing::getCell(uint64_t sequence) const {
+    return (CellHeader*)(cells + (sequence & mask) * cell_stride);
+}
+
+char* IPC::SharedMemoryBroadcastRing::beginWrite() {
+    uint64_t sequence = header->head.load(std::memory_order_relaxed);
+    CellHeader* cell = getCell(sequence);
+    cell->version.store(2 * sequence + 1, std::memory_order_relaxed);
+
+    /// Orders the odd version before the message bytes, a reader that sees new bytes sees the odd version.
+    std::atomic_thread_fence(std::memory_order_release);
+    return (char*)(cell + 1);
+}
+
+uint64_t IPC::SharedMemoryBroadcastRing::endWrite(size_t size) {
+    if (size > header->message_size) {
+        throw std::runtime_error("Shared memory broadcast message exceeds the cell size.");
+    }
+
+    uint64_t sequence = header->head.load(std::memory_order_relaxed);
+    CellHeader* cell = getCell(sequence);
+    cell->size = size;
+    cell->version.store(2 * sequence + 2, std::memory_order_release);
+    header->head.store(sequence + 1, std::memory_order_release);
+
+    /// Pairs with the fence in wait(): either the reader sees the new head or the writer sees the reader waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header->waiters.load(std::memory_order_relaxed) > 0) {
+        header->notify.fetch_add(1, std::memory_order_release);
+        Futex::wakeAll(&header->notify);
+    }
+    return sequence;
+}
+
+uint64_t IPC::SharedMemoryBroadcastRing::publish(const void* data, size_t size) {
+    if (size > header->message_size) {
+        throw std::runtime_error("Shared memory broadcast message exceeds the cell size.");
+    }
+
+    memcpy(beginWrite(), data, size);
+    return endWrite(size);
+}
+
+bool IPC::SharedMemoryBroadcastRing::read(uint64_t& sequence, std::vector<char>& message, uint64_t& lost) const {
+    uint64_t capacity = mask + 1;
+    while (true) {
+        uint64_t head = header->head.load(std::memory_order_acquire);
+        if (sequence >= head) {
+            return false;
+        }
+        if (head - sequence > capacity) {
+            /// The writer lapped the reader, continue with the oldest message still in the ring.
+            lost += head - capacity - sequence;
+            sequence = head - capacity;
+        }
+
+        const CellHeader* cell = getCell(sequence);
+        uint64_t version = cell->version.load(std::memory_order_acquire);
+        if (version != 2 * sequence + 2) {
+            /// Overwritten (or being overwritten) since the head was read, skip ahead to the new tail.
+            if (header->head.load(std::memory_order_acquire) - sequence > capacity) {
+                continue;
+            }
+            lost++;
+            sequence++;
+            continue;
+        }
+
+        size_t size = std::min<uint64_t>(cell->size, header->message_size);
+        message.resize(size);
+        memcpy(message.data(), cell + 1, size);
+
+        /// Orders the copy before the recheck, a changed version means the copy may be torn.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (cell->version.load(std::memory_order_relaxed) != version) {
+            continue;
+        }
+
+        sequence++;
+        return true;
+    }
+}
+
+bool IPC::SharedMemoryBroadcastRing::wait(uint64_t sequence, const timespec* timeout) {
+    uint32_t notify = header->notify.load(std::memory_order_acquire);
+    if (header->head.load(std::memory_order_acquire) > sequence) {
+        return true;
+    }
+
+    header->waiters.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header->head.load(std::memory_order_relaxed) <= sequence) {
+        Futex::wait(&header->notify, notify, timeout);
+    }
+    header->waiters.fetch_sub(1, std::memory_order_relaxed);
+
+    return header->head.load(std::memory_order_acquire) > sequence;
+}
+
+uint64_t IPC::SharedMemoryBroadcastRing::getHead() const {
+    return header->head.load(std::memory_order_acquire);
+}
+
+uint64_t IPC::SharedMemoryBroadcastRing::getTail() const {
+    uint64_t head = getHead();
+    return head > mask + 1 ? head - (mask + 1) : 0;
+}
+
+size_t IPC::SharedMemoryBroadcastRing::getCapacity() const {
+    return mask + 1;
+}
+
+size_t IPC::SharedMemoryBroadcastRing::getMaxMessageSize() const {
+    return header->message_size;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <ctime>
+#include <vector>
+
+#include <shm_manager/shm_manager.h>
+
+namespace IPC {
+    /**
+     * Single-writer/multi-reader broadcast ring of messages that lives in a region of an already mapped shared
+     * memory segment.
+     *
+     * Every message gets the next sequence number and is written into the cell sequence % capacity. The writer
+     * never waits for readers: once the ring is full it overwrites the oldest message, and a reader that fell
+     * behind by more than the capacity skips the messages it lost. Readers keep their position themselves, so
+     * any number of them can read without touching each other or slowing the writer down.
+     *
+     * Every cell is a seqlock: its version is odd while the writer fills it and 2 * sequence + 2 once the
+     * message with that sequence is complete. A reader copies the message out and checks that the version did
+     * not change meanwhile.
+     *
+     * REGION STRUCTURE DETAILS
+     * 1. Head (sequence of the next message, own cache line)
+     * 2. Notification word and waiting reader count (own cache line)
+     * 3. Capacity and cell size (own cache line)
+     * 4. Cells (version + message size + message, cache line aligned)
+     */
+    class SharedMemoryBroadcastRing {
+    public:
+        /**
+         * [shm] The segment that holds the ring, readers must map it writable to wait for messages.
+         * [offset] Offset of the ring region inside the segment (cache line aligned).
+         * [capacity] Number of cells, must be a power of two.
+         * [message_size] Maximum size of a message.
+         * [init] True for the writer that creates the segment, it formats the cells.
+         */
+        SharedMemoryBroadcastRing(SharedMemoryManager* shm, size_t offset, size_t capacity, size_t message_size,
+            bool init);
+
+        /// Returns the number of bytes the ring occupies inside the segment.
+        static size_t requiredSize(size_t capacity, size_t message_size);
+
+        /**
+         * Writer only. Returns the buffer of the next message (getMaxMessageSize() bytes), readers skip the
+         * message until endWrite() publishes it.
+         */
+        char* beginWrite();
+
+        /// Writer only. Publishes the message written since beginWrite(), returns its sequence number.
+        uint64_t endWrite(size_t size);
+
+        /// Writer only. Copies a message into the ring and publishes it, returns its sequence number.
+        uint64_t publish(const void* data, size_t size);
+
+        /**
+         * Copies the message with the given sequence number into message and advances sequence past it.
+         *
+         * If the message was already overwritten, the reader continues with the oldest message that is still
+         * in the ring and lost is increased by the number of skipped messages.
+         *
+         * Returns false if no message with this sequence number has been published yet.
+         */
+        bool read(uint64_t& sequence, std::vector<char>& message, uint64_t& lost) const;
+
+        /**
+         * Blocks until the message with the given sequence number is published.
+         *
+         * [timeout] Relative timeout, nullptr waits forever.
+         *
+         * Returns true once the message is published, false if the wait timed out or was interrupted.
+         */
+        bool wait(uint64_t sequence, const timespec* timeout = nullptr);
+
+        /// Sequence number of the next message, the number of messages published so far.
+        uint64_t getHead() const;
+
+        /// Sequence number of the oldest message still in the ring.
+        uint64_t getTail() const;
+
+        size_t getCapacity() const;
+
+        size_t getMaxMessageSize() const;
+
+    private:
+        static constexpr size_t CACHE_LINE_SIZE = 64;
+
+        struct BroadcastHeader {
+            alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head;
+            alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> notify;
+            std::atomic<uint32_t> waiters;
+            alignas(CACHE_LINE_SIZE) uint64_t capacity;
+            uint64_t message_size;
+        };
+
+        struct CellHeader {
+            /// Odd while the writer fills the cell, 2 * sequence + 2 once the message is complete.
+            std::atomic<uint64_t> version;
+            uint64_t size;
+        };
+
+        static size_t getCellStride(size_t message_size);
+
+        CellHeader* getCell(uint64_t sequence) const;
+
+        BroadcastHeader* header;
+        char* cells;
+        size_t cell_stride;
+        uint64_t mask;
+    };
+}
@@ -1,7 +1,72 @@
 #include <shm_manager/shm_manager.h>
 
-IPC::SharedMemoryManager::SharedMemoryManager::SharedMemoryManager(std::string name, size_t size, bool create)
-    : shm_name(name), shm_size(size), shm_fd(-1), shm_ptr(nullptr) {
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <chrono>
+
+/// Directory of the POSIX shared memory segments, watched while waiting for a segment to be created.
+static constexpr const char* SHM_DIRECTORY = "/dev/shm";
+
+/// Upper bound of a single sleep while waiting for a segment, in case an event is missed.
+static constexpr int OPEN_POLL_INTERVAL_MS = 100;
+
+/// Magic of hugetlbfs in statfs::f_type.
+static constexpr long HUGETLBFS_MAGIC_NUMBER = 0x958458f6;
+
+/// Attempts to lock a segment left behind under the same name, see reclaimSegment().
+static constexpr int RECLAIM_ATTEMPTS = 5;
+static constexpr int RECLAIM_RETRY_INTERVAL_US = 1000;
+
+/// Memory policy constants of mbind, see numaif.h.
+static constexpr int MPOL_PREFERRED_MODE = 1;
+static constexpr size_t NUMA_MAX_NODES = 1024;
+
+static size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * Unlinks a segment left behind under the same name once the process that created it is gone, throws if that
+ * process still holds its owner lock. The segment is locked while it is unlinked, so the check and the unlink
+ * see the same owner.
+ *
+ * A process probing the liveness of a dead owner holds a shared lock for a moment (see isOwnerAlive()), so the
+ * lock is tried a few times before the segment counts as owned.
+ *
+ * [fd] The segment opened by name, -1 if there is none.
+ */
+template <typename Unlink>
+static void reclaimSegment(int fd, Unlink unlink_segment) {
+    if (fd == -1) {
+        return;
+    }
+
+    bool owned = true;
+    for (int attempt = 0; attempt < RECLAIM_ATTEMPTS && owned; attempt++) {
+        if (attempt > 0) {
+            usleep(RECLAIM_RETRY_INTERVAL_US);
+        }
+        owned = flock(fd, LOCK_EX | LOCK_NB) == -1 && errno == EWOULDBLOCK;
+    }
+    if (!owned) {
+        unlink_segment();
+    }
+    close(fd);
+
+    if (owned) {
+        throw std::runtime_error("Shared memory is still owned by a running process.");
+    }
+}
+
+IPC::SharedMemoryManager::SharedMemoryManager::SharedMemoryManager(std::string name, size_t size, bool create,
+    bool read_only, SharedMemoryOptions options)
+    : shm_name(name), shm_size(size), shm_fd(-1), shm_ptr(nullptr), shm_read_only(read_only && !create),
+    shm_owner(false), map_size(size), requested(options) {
     if (create) {
         createMemory();
     }
@@ -39,45 +104,264 @@ void* IPC::SharedMemoryManager::getMemoryPointer(size_t offset) {
 }
 
 void IPC::SharedMemoryManager::removeMemory() {
+    if (!hugetlbfs_file.empty()) {
+        unlink(hugetlbfs_file.c_str());
+        return;
+    }
+
     shm_unlink(shm_name.c_str());
 }
 
-void IPC::SharedMemoryManager::createMemory() {
-    shm_fd = shm_open(shm_name.c_str(), O_CREAT | O_RDWR, 0666);
+size_t IPC::SharedMemoryManager::getSize() const {
+    return shm_size;
+}
+
+const IPC::SharedMemoryOptions& IPC::SharedMemoryManager::getPlacement() const {
+    return placement;
+}
+
+bool IPC::SharedMemoryManager::isOwnerAlive() const {
+    if (shm_owner) {
+        return true;
+    }
     if (shm_fd == -1) {
-        throw std::runtime_error("Failed to create shared memory.");
+        return false;
+    }
+
+    /// A shared lock can only be taken once the owner's exclusive lock is gone, reclaimSegment() retries around it
+    if (flock(shm_fd, LOCK_SH | LOCK_NB) == 0) {
+        flock(shm_fd, LOCK_UN);
+        return false;
+    }
+    return errno == EWOULDBLOCK;
+}
+
+bool IPC::SharedMemoryManager::discardPages(size_t offset, size_t size) {
+    /// Huge pages are only released as a whole, a read only mapping cannot punch holes
+    if (shm_read_only || !hugetlbfs_file.empty() || offset + size > map_size) {
+        return false;
+    }
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t begin = alignUp(offset, page_size);
+    size_t end = (offset + size) / page_size * page_size;
+    if (end <= begin) {
+        return false;
     }
 
+    /// Frees the pages of the segment file, not only the ones of this mapping
+    return madvise((char*)shm_ptr + begin, end - begin, MADV_REMOVE) == 0;
+}
+
+bool IPC::SharedMemoryManager::isRemoved() const {
+    struct stat shm_stat;
+    return shm_fd == -1 || fstat(shm_fd, &shm_stat) == -1 || shm_stat.st_nlink == 0;
+}
+
+void IPC::SharedMemoryManager::createMemory() {
+    /**
+     * A segment left behind under the same name by a process that is gone is unlinked instead of reused,
+     * processes that still map it keep their mapping and see it removed (isRemoved()). The segment of a
+     * running owner is never replaced.
+     */
+    if (requested.huge_pages && !requested.hugetlbfs_path.empty()) {
+        std::string path = requested.hugetlbfs_path + "/" + shm_name;
+        reclaimSegment(open(path.c_str(), O_RDONLY), [&path] { unlink(path.c_str()); });
+    }
+    reclaimSegment(shm_open(shm_name.c_str(), O_RDONLY, 0), [this] { shm_unlink(shm_name.c_str()); });
+
+    if (!requested.huge_pages || !openHugetlbfs(O_CREAT | O_EXCL | O_RDWR)) {
+        shm_fd = shm_open(shm_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+        if (shm_fd == -1) {
+            throw std::runtime_error("Failed to create shared memory.");
+        }
+    }
+
+    /// Held until the segment is closed or this process dies, see isOwnerAlive()
+    shm_owner = flock(shm_fd, LOCK_EX | LOCK_NB) == 0;
+
     // Set the size of the shared memory
-    if (ftruncate(shm_fd, shm_size) == -1) {
+    if (ftruncate(shm_fd, map_size) == -1) {
         throw std::runtime_error("Failed to set shared memory size.");
     }
 
     // Map shared memory into process address space
-    shm_ptr = mmap(0, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    shm_ptr = mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
     if (shm_ptr == MAP_FAILED) {
         throw std::runtime_error("Failed to map shared memory.");
     }
+
+    applyPlacement();
 }
 
 void IPC::SharedMemoryManager::openMemory() {
-    while (true) {
-        shm_fd = shm_open(shm_name.c_str(), O_RDWR, 0666);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max<int64_t>(0, requested.open_timeout_ms));
 
-        if (shm_fd != -1) {
-            break;
+    /// Watch the segment directories before the first attempt so that no creation is missed
+    int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd != -1) {
+        uint32_t mask = IN_CREATE | IN_MODIFY | IN_ATTRIB | IN_MOVED_TO;
+        inotify_add_watch(inotify_fd, SHM_DIRECTORY, mask);
+        if (requested.huge_pages && !requested.hugetlbfs_path.empty()) {
+            inotify_add_watch(inotify_fd, requested.hugetlbfs_path.c_str(), mask);
         }
     }
 
-    shm_ptr = mmap(0, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    while (!tryOpenMemory()) {
+        int wait_ms = OPEN_POLL_INTERVAL_MS;
+        if (requested.open_timeout_ms >= 0) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0) {
+                if (inotify_fd != -1) {
+                    close(inotify_fd);
+                }
+                throw std::runtime_error("Timed out waiting for shared memory.");
+            }
+            wait_ms = std::min<int64_t>(wait_ms, remaining.count() + 1);
+        }
+
+        if (inotify_fd != -1) {
+            /// Sleep until something changes in the watched directories
+            pollfd event = { inotify_fd, POLLIN, 0 };
+            if (poll(&event, 1, wait_ms) > 0) {
+                char events[4096];
+                while (read(inotify_fd, events, sizeof(events)) > 0) {}
+            }
+        }
+        else {
+            usleep(std::min(wait_ms, 10) * 1000);
+        }
+    }
+
+    if (inotify_fd != -1) {
+        close(inotify_fd);
+    }
+
+    shm_ptr = mmap(0, map_size, shm_read_only ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
     if (shm_ptr == MAP_FAILED) {
         throw std::runtime_error("Failed to map shared memory.");
     }
+
+    applyPlacement();
+}
+
+bool IPC::SharedMemoryManager::tryOpenMemory() {
+    map_size = shm_size;
+    if (!requested.huge_pages || !openHugetlbfs(shm_read_only ? O_RDONLY : O_RDWR)) {
+        shm_fd = shm_open(shm_name.c_str(), shm_read_only ? O_RDONLY : O_RDWR, 0666);
+        if (shm_fd == -1) {
+            return false;
+        }
+    }
+
+    /// The creator sizes the segment right after creating it, mapping it earlier would fault on access
+    struct stat shm_stat;
+    if (fstat(shm_fd, &shm_stat) == -1 || shm_stat.st_size == 0 || (size_t)shm_stat.st_size < map_size) {
+        close(shm_fd);
+        shm_fd = -1;
+        hugetlbfs_file.clear();
+        return false;
+    }
+
+    if (shm_size == 0) {
+        shm_size = shm_stat.st_size;
+        map_size = shm_size;
+    }
+    return true;
+}
+
+bool IPC::SharedMemoryManager::openHugetlbfs(int flags) {
+    if (requested.hugetlbfs_path.empty()) {
+        return false;
+    }
+
+    std::string path = requested.hugetlbfs_path + "/" + shm_name;
+    /// Closed on exec like a shm_open() segment, so an exec'd child does not keep the owner lock
+    int fd = open(path.c_str(), flags | O_CLOEXEC, 0666);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct statfs fs;
+    if (fstatfs(fd, &fs) == -1 || fs.f_type != HUGETLBFS_MAGIC_NUMBER) {
+        close(fd);
+        return false;
+    }
+
+    size_t huge_size = alignUp(shm_size, fs.f_bsize);
+    if ((flags & O_CREAT) && (size_t)fs.f_bfree * fs.f_bsize < huge_size) {
+        /// Not enough free huge pages, fall back to a regular segment
+        close(fd);
+        unlink(path.c_str());
+        return false;
+    }
+
+    shm_fd = fd;
+    hugetlbfs_file = path;
+    map_size = shm_size == 0 ? 0 : huge_size;
+    return true;
+}
+
+void IPC::SharedMemoryManager::applyPlacement() {
+    placement = SharedMemoryOptions();
+    placement.hugetlbfs_path = requested.hugetlbfs_path;
+    placement.huge_pages = !hugetlbfs_file.empty();
+
+    if (requested.numa_node != -1) {
+        /// The policy must be set before the pages are faulted in
+        int node = requested.numa_node;
+        if (node == SharedMemoryOptions::NUMA_CURRENT_NODE) {
+            unsigned int cpu = 0;
+            unsigned int current_node = 0;
+            node = syscall(SYS_getcpu, &cpu, &current_node, nullptr) == 0 ? (int)current_node : -1;
+        }
+
+        if (node >= 0 && (size_t)node < NUMA_MAX_NODES) {
+            unsigned long nodemask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = {};
+            nodemask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+            if (syscall(SYS_mbind, shm_ptr, map_size, MPOL_PREFERRED_MODE, nodemask, NUMA_MAX_NODES, 0) == 0) {
+                placement.numa_node = node;
+            }
+        }
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (requested.huge_pages && hugetlbfs_file.empty()) {
+        /// Transparent huge pages for shared memory also depend on /sys/kernel/mm/transparent_hugepage/shmem_enabled
+        placement.huge_pages = madvise(shm_ptr, map_size, MADV_HUGEPAGE) == 0;
+    }
+#endif
+
+    prefault(requested.prefault_size);
+}
+
+void IPC::SharedMemoryManager::prefault(size_t size) {
+    size = std::min(size, map_size);
+    placement.prefault_size = size;
+
+    if (requested.populate) {
+        placement.populate = false;
+#ifdef MADV_POPULATE_WRITE
+        placement.populate = madvise(shm_ptr, size, shm_read_only ? MADV_POPULATE_READ : MADV_POPULATE_WRITE) == 0;
+#endif
+        if (!placement.populate) {
+            /// Older kernels, fault every page in by reading it
+            size_t page_size = sysconf(_SC_PAGESIZE);
+            for (size_t offset = 0; offset < size; offset += page_size) {
+                (void)*(volatile const char*)((const char*)shm_ptr + offset);
+            }
+            placement.populate = true;
+        }
+    }
+
+    if (requested.lock) {
+        placement.lock = mlock(shm_ptr, size) == 0;
+    }
 }
 
 void IPC::SharedMemoryManager::closeMemory() {
     if (shm_ptr) {
-        munmap(shm_ptr, shm_size);
+        munmap(shm_ptr, map_size);
         shm_ptr = nullptr;
     }
     if (shm_fd != -1) {
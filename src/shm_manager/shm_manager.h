@@ -5,12 +5,57 @@
 #include <sys/mman.h>
 #include <cstring>
 #include <fcntl.h> 
+#include <sys/stat.h>
+#include <cstdint>
 #include <string>
 
 namespace IPC {
+    /**
+     * Placement of a mapped segment. Every option falls back gracefully: if the system does not support it
+     * (or the limits do not allow it) the segment is mapped without it, see SharedMemoryManager::getPlacement().
+     */
+    struct SharedMemoryOptions {
+        /// Placement of the segment on the NUMA node of the calling thread.
+        static constexpr int NUMA_CURRENT_NODE = -2;
+
+        /**
+         * Backs the segment with huge pages. A file on the hugetlbfs mount is used if there is one with free
+         * huge pages, otherwise the shared memory segment is advised to use transparent huge pages.
+         * Both sides of a segment must agree on this option, since it changes where the segment lives.
+         */
+        bool huge_pages = false;
+
+        /// Mount point of hugetlbfs.
+        std::string hugetlbfs_path = "/dev/hugepages";
+
+        /// Faults in every page when the segment is mapped instead of on first access.
+        bool populate = false;
+
+        /// Locks the pages of the segment in memory (mlock), subject to RLIMIT_MEMLOCK.
+        bool lock = false;
+
+        /// Number of bytes from the start of the segment populate and lock apply to, the rest is faulted in on
+        /// first access. Set it to 0 and call SharedMemoryManager::prefault() if it is only known after mapping.
+        size_t prefault_size = SIZE_MAX;
+
+        /// Prefers the memory of the given NUMA node for the segment, -1 leaves the placement to the kernel.
+        int numa_node = -1;
+
+        /// How long opening an existing segment waits for it to be created, -1 waits forever.
+        int64_t open_timeout_ms = -1;
+    };
+
     class SharedMemoryManager {
     public:
-        SharedMemoryManager(std::string name, size_t size, bool create = true);
+        /**
+         * [name] Name of the segment.
+         * [size] Size of the segment, 0 maps an existing segment with the size it was created with.
+         * [create] Creates the segment, otherwise an existing segment is opened.
+         * [read_only] Maps an existing segment read only, e.g. to scrape it without touching it.
+         * [options] Placement of the mapping.
+         */
+        SharedMemoryManager(std::string name, size_t size, bool create = true, bool read_only = false,
+            SharedMemoryOptions options = {});
         ~SharedMemoryManager();
 
         /// Write data to shared memory
@@ -25,18 +70,67 @@ namespace IPC {
         /// Remove shared memory (call this manually when done)
         void removeMemory();
 
+        /// Get the size of the mapped shared memory
+        size_t getSize() const;
+
+        /// Placement options that actually took effect, the NUMA node is resolved to the node that was used.
+        const SharedMemoryOptions& getPlacement() const;
+
+        /// True if the segment was removed (or replaced by a new segment of the same name) since it was mapped.
+        bool isRemoved() const;
+
+        /**
+         * True while the process that created the segment is alive. The creator holds an exclusive file lock
+         * on the segment which the kernel drops when the creator exits or crashes, so no process ID is involved.
+         *
+         * The lock belongs to the open segment, which a child forked by the creator inherits: the segment stays
+         * owned until the child exits or execs as well, even if the creator is gone by then.
+         */
+        bool isOwnerAlive() const;
+
+        /**
+         * Gives the whole pages inside the range back to the system, they read as zeroes afterwards in every
+         * process mapping the segment. Returns false if nothing was discarded, e.g. on hugetlbfs.
+         */
+        bool discardPages(size_t offset, size_t size);
+
+        /// Applies the populate and lock options to the first size bytes of the segment, updates getPlacement().
+        void prefault(size_t size);
+
     private:
         std::string shm_name;
         size_t shm_size;
         int shm_fd;
         void* shm_ptr;
+        bool shm_read_only;
+
+        /// True if this process created the segment and holds its owner lock.
+        bool shm_owner;
+
+        /// Length of the mapping, shm_size rounded up to the huge page size on hugetlbfs.
+        size_t map_size;
+
+        /// Path of the segment on hugetlbfs, empty for a POSIX shared memory segment.
+        std::string hugetlbfs_file;
+
+        SharedMemoryOptions requested;
+        SharedMemoryOptions placement;
+
+        /// Open the segment file on hugetlbfs, returns false if that is not possible
+        bool openHugetlbfs(int flags);
+
+        /// Apply the placement options to the fresh mapping
+        void applyPlacement();
 
         /// Create a new shared memory segment
         void createMemory();
 
-        /// Open an existing shared memory segment
+        /// Open an existing shared memory segment, waits until it is created with its full size
         void openMemory();
 
+        /// Try to open the segment once, returns false if it does not exist or is not sized yet
+        bool tryOpenMemory();
+
         /// Close the shared memory segment
         void closeMemory();
     };
@@ -0,0 +1,150 @@
+#include <shm_manager/shm_pool.h>
+
+#include <algorithm>
+#include <bit>
+#include <new>
+#include <stdexcept>
+
+#include <sync/futex.h>
+
+IPC::SharedMemoryPool::SharedMemoryPool(SharedMemoryManager* shm, size_t offset,
+    std::vector<SizeClass> size_classes, bool init, Limits limits)
+    : shm(shm) {
+    if (size_classes.empty()) {
+        throw std::runtime_error("Shared memory pool needs at least one size class.");
+    }
+    if (offset % CACHE_LINE_SIZE != 0) {
+        throw std::runtime_error("Shared memory pool must be cache line aligned.");
+    }
+
+    /// Validates that the whole region is inside the mapping.
+    shm->getMemoryPointer(offset + requiredSize(size_classes));
+
+    size_t header_offset = offset;
+    offset += sizeof(PoolHeader);
+    for (size_t i = 0; i < size_classes.size(); i++) {
+        if (i > 0 && size_classes[i].block_size <= size_classes[i - 1].block_size) {
+            throw std::runtime_error("Shared memory pool size classes must be ordered by block size.");
+        }
+
+        arenas.emplace_back(shm, offset, size_classes[i].block_size, size_classes[i].block_count, init);
+        offset += SharedMemoryArena::requiredSize(size_classes[i].block_size, size_classes[i].block_count);
+    }
+
+    if (init) {
+        /// A single block of the largest class always fits, so every allocation can eventually succeed
+        pool_header = new(shm->getMemoryPointer(header_offset)) PoolHeader{ {0}, {0}, {0},
+            std::max(limits.memory_cap, getMaxBlockSize()), limits.trim_size };
+    }
+    else {
+        pool_header = (PoolHeader*)shm->getMemoryPointer(header_offset);
+    }
+}
+
+std::vector<IPC::SharedMemoryPool::SizeClass> IPC::SharedMemoryPool::powerOfTwoClasses(size_t min_block_size,
+    size_t max_block_size, size_t block_count, size_t min_block_count) {
+    std::vector<SizeClass> size_classes;
+    size_t block_size = std::bit_ceil(min_block_size);
+    for (size_t i = 0; block_size <= std::bit_ceil(max_block_size); i++, block_size *= 2) {
+        size_classes.push_back({ block_size, std::max(min_block_count, i < 64 ? block_count >> i : 0) });
+    }
+    return size_classes;
+}
+
+size_t IPC::SharedMemoryPool::requiredSize(const std::vector<SizeClass>& size_classes) {
+    size_t size = sizeof(PoolHeader);
+    for (const auto& size_class : size_classes) {
+        size += SharedMemoryArena::requiredSize(size_class.block_size, size_class.block_count);
+    }
+    return size;
+}
+
+size_t IPC::SharedMemoryPool::allocate(size_t size, bool bounded) {
+    for (auto& arena : arenas) {
+        size_t block_size = arena.getBlockSize();
+        if (block_size < size) {
+            continue;
+        }
+
+        /// Account the block first, so that concurrent allocations never exceed the cap together
+        uint64_t used = pool_header->used_bytes.load(std::memory_order_relaxed);
+        do {
+            if (bounded && used + block_size > pool_header->memory_cap) {
+                /// The larger classes do not fit either
+                return npos;
+            }
+        } while (!pool_header->used_bytes.compare_exchange_weak(used, used + block_size, std::memory_order_relaxed));
+
+        size_t block_offset = arena.allocate();
+        if (block_offset != npos) {
+            return block_offset;
+        }
+        pool_header->used_bytes.fetch_sub(block_size, std::memory_order_relaxed);
+    }
+    return npos;
+}
+
+void IPC::SharedMemoryPool::release(size_t block_offset) {
+    SharedMemoryArena& arena = arenas[getArenaIndex(block_offset)];
+    size_t block_size = arena.getBlockSize();
+    if (block_size >= pool_header->trim_size) {
+        /// Best effort, a segment that cannot discard its pages keeps them
+        shm->discardPages(block_offset, block_size);
+    }
+
+    arena.release(block_offset);
+    pool_header->used_bytes.fetch_sub(block_size, std::memory_order_relaxed);
+    pool_header->releases.fetch_add(1, std::memory_order_release);
+
+    /// Pairs with the fence in waitForRelease(): either the waiter sees the release or the releaser sees it waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (pool_header->waiters.load(std::memory_order_relaxed) > 0) {
+        Futex::wakeAll(&pool_header->releases);
+    }
+}
+
+uint32_t IPC::SharedMemoryPool::getReleaseCount() const {
+    return pool_header->releases.load(std::memory_order_acquire);
+}
+
+bool IPC::SharedMemoryPool::waitForRelease(uint32_t release_count, const timespec* timeout) {
+    pool_header->waiters.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    bool released = true;
+    if (pool_header->releases.load(std::memory_order_relaxed) == release_count) {
+        released = Futex::wait(&pool_header->releases, release_count, timeout);
+    }
+    pool_header->waiters.fetch_sub(1, std::memory_order_relaxed);
+    return released;
+}
+
+size_t IPC::SharedMemoryPool::getUsedBytes() const {
+    return pool_header->used_bytes.load(std::memory_order_relaxed);
+}
+
+size_t IPC::SharedMemoryPool::getMemoryCap() const {
+    return pool_header->memory_cap;
+}
+
+void* IPC::SharedMemoryPool::getBlockPointer(size_t block_offset) {
+    return arenas[getArenaIndex(block_offset)].getBlockPointer(block_offset);
+}
+
+size_t IPC::SharedMemoryPool::getBlockSize(size_t block_offset) const {
+    return arenas[getArenaIndex(block_offset)].getBlockSize();
+}
+
+size_t IPC::SharedMemoryPool::getMaxBlockSize() const {
+    return arenas.back().getBlockSize();
+}
+
+size_t IPC::SharedMemoryPool::getArenaIndex(size_t block_offset) const {
+    for (size_t i = 0; i < arenas.size(); i++) {
+        if (arenas[i].contains(block_offset)) {
+            return i;
+        }
+    }
+
+    throw std::runtime_error("Invalid shared memory pool block offset.");
+}
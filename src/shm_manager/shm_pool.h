@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <utility>
+#include <vector>
+
+#include <shm_manager/shm_manager.h>
+#include <shm_manager/shm_arena.h>
+
+namespace IPC {
+    /**
+     * Sub-allocates blocks of different sizes out of a region of an already mapped shared memory segment.
+     *
+     * The pool is a list of size classes, each one is a SharedMemoryArena of equally sized blocks laid out
+     * one after the other. An allocation takes a block from the smallest class that fits the requested size
+     * and falls back to the larger classes when that class is exhausted.
+     *
+     * The bytes of the allocated blocks are counted in the pool header, so a cap bounds the memory all
+     * processes take from the pool at once. A process that hits the cap or finds no free block can park until
+     * another process releases a block. Blocks of the large classes give their pages back to the system when
+     * they are released, so the resident size of the pool follows the blocks in use.
+     *
+     * REGION STRUCTURE DETAILS
+     * 1. Pool header (used bytes, release counter, limits, own cache line)
+     * 2. Arenas of the size classes, ordered by block size
+     */
+    class SharedMemoryPool {
+    public:
+        struct SizeClass {
+            size_t block_size;
+            size_t block_count;
+        };
+
+        struct Limits {
+            /// Maximum number of bytes of blocks allocated at once with bounded allocations, at least one block
+            /// of the largest class always fits.
+            size_t memory_cap = SIZE_MAX;
+
+            /// Blocks of at least this size give their pages back to the system when they are released.
+            size_t trim_size = SIZE_MAX;
+        };
+
+        /// Size classes of block_count >> i blocks (at least min_block_count) of power of two sizes from
+        /// min_block_size up to max_block_size, both rounded up to a power of two.
+        static std::vector<SizeClass> powerOfTwoClasses(size_t min_block_size, size_t max_block_size,
+            size_t block_count, size_t min_block_count);
+
+        /// Returned by allocate() when no block of the requested size is free.
+        static constexpr size_t npos = SharedMemoryArena::npos;
+
+        /**
+         * [shm] The segment that holds the pool.
+         * [offset] Offset of the pool region inside the segment.
+         * [size_classes] The size classes, ordered by block size.
+         * [init] True for the process that creates the segment, it formats the free lists.
+         * [limits] Written by the process that creates the segment, the others read them from the header.
+         */
+        SharedMemoryPool(SharedMemoryManager* shm, size_t offset, std::vector<SizeClass> size_classes, bool init,
+            Limits limits);
+
+        /// A pool without memory cap whose blocks keep their pages.
+        SharedMemoryPool(SharedMemoryManager* shm, size_t offset, std::vector<SizeClass> size_classes, bool init)
+            : SharedMemoryPool(shm, offset, std::move(size_classes), init, Limits()) {}
+
+        /// Returns the number of bytes the pool occupies inside the segment.
+        static size_t requiredSize(const std::vector<SizeClass>& size_classes);
+
+        /**
+         * Takes a block of at least the given size, returns its segment offset or npos if none is free.
+         *
+         * [bounded] True fails once the block would exceed the memory cap. False takes the block anyway, for
+         * blocks whose allocation must neither fail nor wait on other blocks.
+         */
+        size_t allocate(size_t size, bool bounded = true);
+
+        /// Returns a block to its size class and wakes the processes waiting for a block.
+        void release(size_t block_offset);
+
+        /// Number of releases so far, observe it before an allocation that may fail to wait with waitForRelease().
+        uint32_t getReleaseCount() const;
+
+        /**
+         * Blocks until a block is released after the release count was observed.
+         *
+         * [timeout] Relative timeout, nullptr waits forever.
+         *
+         * Returns false if the wait timed out.
+         */
+        bool waitForRelease(uint32_t release_count, const timespec* timeout = nullptr);
+
+        /// Number of bytes of the blocks currently allocated.
+        size_t getUsedBytes() const;
+
+        /// Maximum number of bytes of blocks allocated at once with bounded allocations.
+        size_t getMemoryCap() const;
+
+        /// Get the pointer to the block at the given segment offset.
+        void* getBlockPointer(size_t block_offset);
+
+        /// Usable size of the block at the given segment offset.
+        size_t getBlockSize(size_t block_offset) const;
+
+        /// Usable size of the blocks of the largest size class.
+        size_t getMaxBlockSize() const;
+
+    private:
+        static constexpr size_t CACHE_LINE_SIZE = 64;
+
+        struct alignas(CACHE_LINE_SIZE) PoolHeader {
+            std::atomic<uint64_t> used_bytes;
+
+            /// Futex word, bumped by every release.
+            std::atomic<uint32_t> releases;
+
+            /// Number of processes parked on the release counter.
+            std::atomic<uint32_t> waiters;
+
+            uint64_t memory_cap;
+            uint64_t trim_size;
+        };
+
+        /// Index of the size class the block at the given segment offset belongs to.
+        size_t getArenaIndex(size_t block_offset) const;
+
+        SharedMemoryManager* shm;
+        PoolHeader* pool_header;
+        std::vector<SharedMemoryArena> arenas;
+    };
+}
@@ -0,0 +1,97 @@
+#include <shm_manager/shm_ring.h>
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+IPC::SharedMemoryRing::SharedMemoryRing(SharedMemoryManager* shm, size_t offset, size_t capacity, bool init)
+    : mask(capacity - 1) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        throw std::runtime_error("Shared memory ring capacity must be a power of two.");
+    }
+    if (offset % CACHE_LINE_SIZE != 0) {
+        throw std::runtime_error("Shared memory ring must be cache line aligned.");
+    }
+
+    /// Validates that the whole region is inside the mapping.
+    shm->getMemoryPointer(offset + requiredSize(capacity));
+
+    if (init) {
+        ring_header = new(shm->getMemoryPointer(offset)) RingHeader{ {0}, {0}, capacity };
+        cells = (RingCell*)shm->getMemoryPointer(offset + sizeof(RingHeader));
+
+        for (size_t i = 0; i < capacity; i++) {
+            new(&cells[i]) RingCell{ {i}, 0 };
+        }
+    }
+    else {
+        ring_header = (RingHeader*)shm->getMemoryPointer(offset);
+        cells = (RingCell*)shm->getMemoryPointer(offset + sizeof(RingHeader));
+
+        if (ring_header->capacity != capacity) {
+            throw std::runtime_error("Shared memory ring layout mismatch.");
+        }
+    }
+}
+
+size_t IPC::SharedMemoryRing::requiredSize(size_t capacity) {
+    return sizeof(RingHeader) + sizeof(RingCell) * capacity;
+}
+
+bool IPC::SharedMemoryRing::push(uint64_t value) {
+    uint64_t position = ring_header->head.load(std::memory_order_relaxed);
+    while (true) {
+        RingCell& cell = cells[position & mask];
+        uint64_t sequence = cell.sequence.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)(sequence - position);
+
+        if (diff == 0) {
+            /// The cell is free for this position, try to claim it.
+            if (ring_header->head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                cell.value = value;
+                cell.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0) {
+            /// The consumer has not released this cell for the current lap yet.
+            return false;
+        }
+        else {
+            /// Another producer claimed the position, reload it.
+            position = ring_header->head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool IPC::SharedMemoryRing::pop(uint64_t& value) {
+    uint64_t position = ring_header->tail.load(std::memory_order_relaxed);
+    RingCell& cell = cells[position & mask];
+    uint64_t sequence = cell.sequence.load(std::memory_order_acquire);
+
+    if ((int64_t)(sequence - (position + 1)) < 0) {
+        return false;
+    }
+
+    value = cell.value;
+    ring_header->tail.store(position + 1, std::memory_order_relaxed);
+
+    /// Hand the cell back to the producers for the next lap.
+    cell.sequence.store(position + mask + 1, std::memory_order_release);
+    return true;
+}
+
+bool IPC::SharedMemoryRing::empty() const {
+    uint64_t position = ring_header->tail.load(std::memory_order_relaxed);
+    return cells[position & mask].sequence.load(std::memory_order_acquire) != position + 1;
+}
+
+size_t IPC::SharedMemoryRing::size() const {
+    uint64_t tail = ring_header->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring_header->head.load(std::memory_order_relaxed);
+    return head > tail ? std::min<uint64_t>(head - tail, mask + 1) : 0;
+}
+
+size_t IPC::SharedMemoryRing::getCapacity() const {
+    return mask + 1;
+}
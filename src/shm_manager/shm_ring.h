@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include <shm_manager/shm_manager.h>
+
+namespace IPC {
+    /**
+     * Bounded multi-producer/single-consumer queue of 64-bit values that lives in a region of an already
+     * mapped shared memory segment.
+     *
+     * Producers from any process claim a cell by advancing the head with a CAS and publish the value through
+     * the per-cell sequence number, so no lock is taken on either side. The head and the tail are kept on
+     * separate cache lines so that producers and the consumer do not invalidate each other.
+     *
+     * REGION STRUCTURE DETAILS
+     * 1. Head (enqueue position, own cache line)
+     * 2. Tail (dequeue position, own cache line)
+     * 3. Capacity (own cache line)
+     * 4. Cells (sequence number + value)
+     */
+    class SharedMemoryRing {
+    public:
+        /**
+         * [shm] The segment that holds the ring.
+         * [offset] Offset of the ring region inside the segment (cache line aligned).
+         * [capacity] Number of cells, must be a power of two.
+         * [init] True for the process that creates the segment, it formats the cells.
+         */
+        SharedMemoryRing(SharedMemoryManager* shm, size_t offset, size_t capacity, bool init);
+
+        /// Returns the number of bytes the ring occupies inside the segment.
+        static size_t requiredSize(size_t capacity);
+
+        /// Enqueues a value, safe to call from any thread of any process. Returns false if the ring is full.
+        bool push(uint64_t value);
+
+        /// Dequeues a value, must only be called by the single consumer. Returns false if the ring is empty.
+        bool pop(uint64_t& value);
+
+        /// True if there is no value ready to be dequeued.
+        bool empty() const;
+
+        /// Approximate number of values in the ring, exact only while no value is pushed or popped.
+        size_t size() const;
+
+        /// Number of cells in the ring.
+        size_t getCapacity() const;
+
+    private:
+        static constexpr size_t CACHE_LINE_SIZE = 64;
+
+        struct RingHeader {
+            alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head;
+            alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail;
+            alignas(CACHE_LINE_SIZE) uint64_t capacity;
+        };
+
+        struct RingCell {
+            /// Equal to the position when the cell is free for that position, position + 1 once published.
+            std::atomic<uint64_t> sequence;
+            uint64_t value;
+        };
+
+        RingHeader* ring_header;
+        RingCell* cells;
+        uint64_t mask;
+    };
+}
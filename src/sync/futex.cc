@@ -0,0 +1,29 @@
+#include <sync/futex.h>
+
+#include <climits>
+#include <cerrno>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Futex words must be plain 32-bit integers");
+
+static long futex(std::atomic<uint32_t>* word, int op, uint32_t value, const timespec* timeout) {
+    return syscall(SYS_futex, (uint32_t*)word, op, value, timeout, nullptr, 0);
+}
+
+bool IPC::Futex::wait(std::atomic<uint32_t>* word, uint32_t expected, const timespec* timeout) {
+    if (futex(word, FUTEX_WAIT, expected, timeout) == -1 && errno == ETIMEDOUT) {
+        return false;
+    }
+
+    return true;
+}
+
+void IPC::Futex::wake(std::atomic<uint32_t>* word, int count) {
+    futex(word, FUTEX_WAKE, count, nullptr);
+}
+
+void IPC::Futex::wakeAll(std::atomic<uint32_t>* word) {
+    futex(word, FUTEX_WAKE, INT_MAX, nullptr);
+}
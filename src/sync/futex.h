@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+namespace IPC {
+    /**
+     * Thin wrappers around the Linux futex syscall for words that live in shared memory.
+     *
+     * The shared (non private) futex operations are used so that a waiter in one process can be woken by
+     * another process mapping the same word.
+     */
+    namespace Futex {
+        /**
+         * Blocks while the word holds the expected value.
+         *
+         * [word] The futex word.
+         * [expected] The value the caller observed, the call returns immediately if the word changed.
+         * [timeout] Relative timeout, nullptr waits forever.
+         *
+         * Returns false if the wait timed out, true otherwise (woken, value changed or interrupted).
+         */
+        bool wait(std::atomic<uint32_t>* word, uint32_t expected, const timespec* timeout = nullptr);
+
+        /// Wakes up to count waiters blocked on the word.
+        void wake(std::atomic<uint32_t>* word, int count = 1);
+
+        /// Wakes every waiter blocked on the word.
+        void wakeAll(std::atomic<uint32_t>* word);
+
+        /// Hints the CPU that the caller is in a spin loop.
+        inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__)
+            asm volatile("yield" ::: "memory");
+#endif
+        }
+
+        /**
+         * Polls the predicate up to spin_count times with a CPU pause between the polls.
+         *
+         * Returns true as soon as the predicate holds, false if the spin budget is exhausted.
+         */
+        template <typename Predicate>
+        bool spinUntil(Predicate predicate, uint32_t spin_count) {
+            for (uint32_t i = 0; i < spin_count; i++) {
+                if (predicate()) return true;
+                cpuRelax();
+            }
+            return predicate();
+        }
+    }
+
+    /**
+     * Spin budget that adapts to how often spinning pays off.
+     *
+     * The budget is doubled (up to the configured maximum) every time the predicate became true while spinning
+     * and halved (down to a small floor) every time the waiter had to park anyway, for example when the other
+     * side is descheduled or runs on the same CPU. Safe to share between threads.
+     */
+    class AdaptiveSpin {
+    public:
+        explicit AdaptiveSpin(uint32_t max_spin_count)
+            : max_spin_count_(max_spin_count), spin_count_(max_spin_count) {}
+
+        /**
+         * Polls the predicate for the current budget, returns true if it holds, false if the caller should park.
+         */
+        template <typename Predicate>
+        bool spinUntil(Predicate predicate) {
+            uint32_t spin_count = spin_count_.load(std::memory_order_relaxed);
+            if (Futex::spinUntil(predicate, spin_count)) {
+                spin_count_.store(std::min(max_spin_count_, spin_count * 2), std::memory_order_relaxed);
+                return true;
+            }
+
+            spin_count_.store(std::min(max_spin_count_, std::max(MIN_SPIN_COUNT, spin_count / 2)),
+                std::memory_order_relaxed);
+            return false;
+        }
+
+    private:
+        static constexpr uint32_t MIN_SPIN_COUNT = 16;
+
+        const uint32_t max_spin_count_;
+        std::atomic<uint32_t> spin_count_;
+    };
+}
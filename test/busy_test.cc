@@ -0,0 +1,183 @@
+/**
+ * Calls the registry does not run right away: busy rejections and their retries, calls that expire while
+ * queued, and awaited calls that complete out of order.
+ */
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <string>
+#include <thread>
+
+#include <fn/fn_invoker.h>
+#include <fn/fn_registry.h>
+
+#include "test.h"
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    /// Coroutine that runs eagerly and is never awaited itself.
+    struct Task {
+        struct promise_type {
+            Task get_return_object() { return {}; }
+            std::suspend_never initial_suspend() { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    std::atomic<bool> blocked{ false };
+    std::atomic<int> runs{ 0 };
+
+    /// Runs until blocked is cleared, only one call may be pending at once.
+    int block(int value) {
+        while (blocked) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return value;
+    }
+
+    int sleepMs(int ms) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+        return ms;
+    }
+
+    int count(int value) {
+        runs++;
+        return value;
+    }
+
+    int64_t elapsedMs(Clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+    }
+
+    template <typename Predicate>
+    void waitUntil(Predicate predicate) {
+        auto deadline = Clock::now() + std::chrono::seconds(10);
+        while (!predicate() && Clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        CHECK(predicate());
+    }
+
+    void testBusy(const std::string& channel_name) {
+        IPC::ChannelOptions no_retry = Test::getInvokerOptions();
+        no_retry.busy_retry_count = 0;
+        IPC::FunctionInvoker invoker(channel_name, no_retry);
+
+        blocked = true;
+        IPC::CallFuture<int> held = invoker.callAsync<int(int)>("block", 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        CHECK_THROWS(IPC::ServerBusyError, invoker.call<int(int)>("block", 2));
+
+        /// A retried call gets through once the pending call finished
+        IPC::ChannelOptions retry = Test::getInvokerOptions();
+        retry.busy_retry_count = 50;
+        retry.busy_backoff_us = 2000;
+        IPC::FunctionInvoker retrying(channel_name, retry);
+        std::thread release([] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            blocked = false;
+            });
+        CHECK(retrying.call<int(int)>("block", 3) == 3);
+        release.join();
+        CHECK(held.get() == 1);
+    }
+
+    void testAwaitedBusy(const std::string& channel_name) {
+        IPC::ChannelOptions options = Test::getInvokerOptions();
+        options.busy_retry_count = 2;
+        options.busy_backoff_us = 100000;
+        IPC::FunctionInvoker invoker(channel_name, options);
+
+        blocked = true;
+        IPC::CallFuture<int> held = invoker.callAsync<int(int)>("block", 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        /// Two retries back off 150 to 300 ms, every further retry would add at least 200 ms
+        std::atomic<bool> done{ false };
+        std::atomic<int64_t> busy_after_ms{ -1 };
+        auto start = Clock::now();
+        auto await_busy = [&]() -> Task {
+            try {
+                co_await invoker.callAsync<int(int)>("block", 2);
+            }
+            catch (const IPC::ServerBusyError&) {
+                busy_after_ms = elapsedMs(start);
+            }
+            done = true;
+            };
+        await_busy();
+        waitUntil([&done] { return done.load(); });
+        CHECK(busy_after_ms >= 150 && busy_after_ms < 450);
+
+        blocked = false;
+        CHECK(held.get() == 1);
+    }
+
+    void testExpired(const std::string& channel_name) {
+        IPC::FunctionInvoker invoker(channel_name, Test::getInvokerOptions());
+        runs = 0;
+
+        /// The registry runs the calls one at a time, the short call expires behind the long one
+        IPC::CallFuture<int> sleeping = invoker.callAsync<int(int)>("sleep", 300);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        auto expiring = invoker.resolve<int(int)>("count", IPC::CallOptions{ .timeout_ms = 50 });
+        CHECK_THROWS(std::runtime_error, invoker.call(expiring, 1));
+        CHECK(sleeping.get() == 300);
+
+        /// The expired call never ran, the registry still serves the next one
+        CHECK(invoker.call<int(int)>("count", 2) == 2);
+        CHECK(runs == 1);
+    }
+
+    void testCompletionOrder(const std::string& channel_name) {
+        IPC::FunctionInvoker invoker(channel_name, Test::getInvokerOptions());
+
+        /// Later calls are resumed while the first awaited call is still running
+        std::atomic<int> fast_done{ 0 };
+        std::atomic<bool> slow_done{ false };
+        std::atomic<bool> overtaken{ false };
+        auto await_slow = [&]() -> Task {
+            co_await invoker.callAsync<int(int)>("sleep", 500);
+            overtaken = fast_done == 4;
+            slow_done = true;
+            };
+        auto await_fast = [&](int value) -> Task {
+            CHECK(co_await invoker.callAsync<int(int)>("count", value) == value);
+            fast_done++;
+            };
+
+        await_slow();
+        for (int i = 0; i < 4; i++) {
+            await_fast(i);
+        }
+        waitUntil([&slow_done] { return slow_done.load(); });
+        CHECK(overtaken);
+    }
+
+    void setup(IPC::FunctionRegistry& registry) {
+        registry.registerFunction<&block>("block", IPC::FunctionOptions{ .max_pending = 1 });
+        registry.registerFunction<&sleepMs>("sleep");
+        registry.registerFunction<&count>("count");
+    }
+}
+
+int main() {
+    std::string inline_channel = Test::getChannelName("busy-inline");
+    std::string pool_channel = Test::getChannelName("busy-pool");
+
+    IPC::ChannelOptions pool_options;
+    pool_options.worker_count = 4;
+    Test::startRegistry(inline_channel, {}, setup);
+    Test::startRegistry(pool_channel, pool_options, setup);
+
+    testBusy(pool_channel);
+    testAwaitedBusy(pool_channel);
+    testExpired(inline_channel);
+    testCompletionOrder(pool_channel);
+
+    Test::finish({ inline_channel, pool_channel });
+}
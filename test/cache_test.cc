@@ -0,0 +1,94 @@
+/**
+ * Hits, eviction and expiry of the result cache of a function, in the registry and in the invoker.
+ */
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <fn/fn_cache.h>
+#include <fn/fn_invoker.h>
+#include <fn/fn_registry.h>
+
+#include "test.h"
+
+namespace {
+    std::string find(IPC::ResultCache& cache, std::string_view key) {
+        std::string result = "<miss>";
+        cache.find(key, [&result](std::string_view cached) { result = cached; });
+        return result;
+    }
+
+    void testEviction() {
+        IPC::ResultCache cache(2, -1);
+        cache.insert("a", "1");
+        cache.insert("b", "2");
+        CHECK(find(cache, "a") == "1");
+
+        /// b is the least recently used one now
+        cache.insert("c", "3");
+        CHECK(find(cache, "b") == "<miss>");
+        CHECK(find(cache, "a") == "1");
+        CHECK(find(cache, "c") == "3");
+
+        cache.insert("a", "4");
+        CHECK(find(cache, "a") == "4");
+        CHECK(cache.getHits() == 4);
+        CHECK(cache.getMisses() == 1);
+    }
+
+    void testExpiry() {
+        IPC::ResultCache cache(4, 50);
+        cache.insert("a", "1");
+        CHECK(find(cache, "a") == "1");
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(80));
+        CHECK(find(cache, "a") == "<miss>");
+
+        /// An expired result is replaced by the next insert
+        cache.insert("a", "2");
+        CHECK(find(cache, "a") == "2");
+    }
+
+    std::atomic<int> squares{ 0 };
+
+    int square(int value) {
+        squares++;
+        return value * value;
+    }
+
+    void testFunctionCache(const std::string& channel_name, bool client_cache) {
+        squares = 0;
+        IPC::FunctionInvoker invoker(channel_name, Test::getInvokerOptions());
+        std::string name = client_cache ? "client_square" : "square";
+
+        CHECK(invoker.call<int(int)>(name, 3) == 9);
+        CHECK(invoker.call<int(int)>(name, 3) == 9);
+        CHECK(squares == 1);
+
+        /// Different arguments are a different key
+        CHECK(invoker.call<int(int)>(name, 4) == 16);
+        CHECK(squares == 2);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(150));
+        CHECK(invoker.call<int(int)>(name, 3) == 9);
+        CHECK(squares == 3);
+    }
+}
+
+int main() {
+    testEviction();
+    testExpiry();
+
+    std::string channel_name = Test::getChannelName("cache");
+    Test::startRegistry(channel_name, {}, [](IPC::FunctionRegistry& registry) {
+        registry.registerFunction<&square>("square", IPC::FunctionOptions{ .cache_size = 8, .cache_ttl_ms = 100 });
+        registry.registerFunction<&square>("client_square",
+            IPC::FunctionOptions{ .cache_size = 8, .cache_ttl_ms = 100, .client_cache = true });
+        });
+    testFunctionCache(channel_name, false);
+    testFunctionCache(channel_name, true);
+
+    Test::finish({ channel_name });
+}
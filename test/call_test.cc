@@ -0,0 +1,132 @@
+/**
+ * Calls that fail in the registry: functions that throw, frames that do not decode, and streams that cannot be
+ * sent. The registry must answer every one of them with an error and keep serving.
+ */
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+#include <fn/fn_invoker.h>
+#include <fn/fn_registry.h>
+#include <fn/fn_stream.h>
+
+#include "test.h"
+
+namespace {
+    int twice(int value) {
+        if (value < 0) {
+            throw std::invalid_argument("negative " + std::to_string(value));
+        }
+        return value * 2;
+    }
+
+    void throwInt() {
+        throw 42;
+    }
+
+    void setup(IPC::FunctionRegistry& registry) {
+        registry.registerFunction<&twice>("twice");
+        registry.registerFunction<&throwInt>("throw_int");
+        registry.registerStream<int, int>("count", std::function<void(IPC::StreamWriter<int>&, int)>(
+            [](IPC::StreamWriter<int>& out, int n) {
+                for (int i = 0; i < n && out.write(i); i++) {}
+            }));
+        registry.registerStream<std::string, int>("huge", std::function<void(IPC::StreamWriter<std::string>&, int)>(
+            [](IPC::StreamWriter<std::string>& out, int size) {
+                out.write("small");
+                if (out.write(std::string(size, 'x')) || !out.isCancelled()) {
+                    throw std::logic_error("An oversized item was accepted");
+                }
+            }));
+    }
+
+    void testExceptions(IPC::FunctionInvoker& invoker) {
+        try {
+            invoker.call<int(int)>("twice", -3);
+            CHECK(false);
+        }
+        catch (const IPC::FunctionCallError& e) {
+            CHECK(std::string(e.what()).find("negative -3") != std::string::npos);
+        }
+
+        CHECK_THROWS(IPC::FunctionCallError, invoker.call<void()>("throw_int"));
+        CHECK(invoker.call<int(int)>("twice", 21) == 42);
+    }
+
+    void testBadFrames(IPC::FunctionInvoker& invoker) {
+        uint16_t twice_id = invoker.resolve<int(int)>("twice").id;
+
+        /// Arguments shorter than the signature of the function
+        IPC::Method<int()> no_args{ twice_id };
+        CHECK_THROWS(IPC::FunctionCallError, invoker.call(no_args));
+
+        IPC::Method<int(int)> unknown{ 999 };
+        CHECK_THROWS(IPC::FunctionCallError, invoker.call(unknown, 1));
+
+        CHECK(invoker.call<int(int)>("twice", 5) == 10);
+    }
+
+    void testBatch(IPC::FunctionInvoker& invoker) {
+        auto twice_method = invoker.resolve<int(int)>("twice");
+        IPC::CallBatch batch;
+        auto first = batch.add(twice_method, 1);
+        auto failed = batch.add(twice_method, -1);
+        auto last = batch.add(twice_method, 5);
+
+        /// A failed call does not fail the calls around it
+        IPC::BatchResult result = invoker.invokeBatch(batch);
+        CHECK(result.get(first) == 2);
+        CHECK(result.get(last) == 10);
+        CHECK_THROWS(IPC::FunctionCallError, result.get(failed));
+    }
+
+    void testStreams(IPC::FunctionInvoker& invoker) {
+        IPC::CallStream<int> items = invoker.stream<int(int)>("count", 100);
+        int count = 0;
+        while (std::optional<int> item = items.next()) {
+            CHECK(*item == count);
+            count++;
+        }
+        CHECK(count == 100);
+
+        /// CallBatch::add() rejects a stream at compile time, a raw method ID is rejected by the registry
+        IPC::Method<int(int)> count_method{ invoker.resolve<IPC::Stream<int>(int)>("count").id };
+        IPC::CallBatch batch;
+        batch.add(invoker.resolve<int(int)>("twice"), 1);
+        batch.add(count_method, 3);
+        CHECK_THROWS(IPC::FunctionCallError, invoker.invokeBatch(batch));
+
+        /// The items before the oversized one arrive, then the call fails
+        IPC::CallStream<std::string> huge = invoker.stream<std::string(int)>("huge", 1 << 20);
+        try {
+            CHECK(huge.next() == "small");
+            huge.next();
+            CHECK(false);
+        }
+        catch (const IPC::FunctionCallError& e) {
+            CHECK(std::string(e.what()).find("exceeds the call slot size") != std::string::npos);
+        }
+
+        CHECK(invoker.call<int(int)>("twice", 4) == 8);
+    }
+}
+
+int main() {
+    std::string inline_channel = Test::getChannelName("call-inline");
+    std::string pool_channel = Test::getChannelName("call-pool");
+
+    IPC::ChannelOptions pool_options;
+    pool_options.worker_count = 2;
+    Test::startRegistry(inline_channel, {}, setup);
+    Test::startRegistry(pool_channel, pool_options, setup);
+
+    for (const std::string& channel_name : { inline_channel, pool_channel }) {
+        IPC::FunctionInvoker invoker(channel_name, Test::getInvokerOptions());
+        testExceptions(invoker);
+        testBadFrames(invoker);
+        testBatch(invoker);
+        testStreams(invoker);
+    }
+
+    Test::finish({ inline_channel, pool_channel });
+}
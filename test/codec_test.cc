@@ -0,0 +1,161 @@
+/**
+ * Round trips of the argument and return value codecs, and the types they reject.
+ */
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fn/fn_codec.h>
+#include <fn/fn_stream.h>
+
+#include "test.h"
+
+namespace {
+    struct Point {
+        double x;
+        double y;
+
+        bool operator==(const Point&) const = default;
+    };
+
+    enum class Color : uint8_t { RED, GREEN, BLUE };
+
+    struct WithPointer {
+        const char* name;
+    };
+
+    /// Encodes the value into a buffer of its encoded size, decodes it again and checks that all bytes are read.
+    template <typename T>
+    T roundTrip(const T& value) {
+        std::vector<char> buffer(IPC::Codec<T>::size(value));
+        IPC::BufferWriter writer(buffer.data(), buffer.size());
+        IPC::Codec<T>::encode(writer, value);
+        CHECK(!writer.overflowed());
+        CHECK(writer.size() == buffer.size());
+
+        IPC::BufferReader reader(buffer.data(), buffer.size());
+        T decoded = IPC::Codec<T>::decode(reader);
+        CHECK(reader.remaining() == 0);
+        return decoded;
+    }
+
+    void testScalars() {
+        CHECK(roundTrip<int>(-42) == -42);
+        CHECK(roundTrip<uint64_t>(UINT64_MAX) == UINT64_MAX);
+        CHECK(roundTrip<double>(0.25) == 0.25);
+        CHECK(roundTrip<bool>(true));
+        CHECK(IPC::Codec<int>::size(7) == sizeof(int));
+    }
+
+    void testVarints() {
+        for (uint64_t value : std::initializer_list<uint64_t>{ 0, 127, 128, 16383, 16384, UINT32_MAX, UINT64_MAX }) {
+            char buffer[10];
+            IPC::BufferWriter writer(buffer, sizeof(buffer));
+            writer.writeVarint(value);
+            CHECK(writer.size() == IPC::varintSize(value));
+
+            IPC::BufferReader reader(buffer, writer.size());
+            CHECK(reader.readVarint() == value);
+        }
+    }
+
+    void testStrings() {
+        CHECK(roundTrip<std::string>("") == "");
+        CHECK(roundTrip<std::string>("hello") == "hello");
+        std::string large(100000, 'x');
+        CHECK(roundTrip<std::string>(large) == large);
+        CHECK(IPC::Codec<std::string>::size("abc") == 1 + 3);
+    }
+
+    void testViews() {
+        std::vector<char> buffer(64);
+        IPC::BufferWriter writer(buffer.data(), buffer.size());
+        IPC::Codec<std::string_view>::encode(writer, "view");
+        std::byte bytes[] = { std::byte{ 1 }, std::byte{ 2 }, std::byte{ 3 } };
+        IPC::Codec<std::span<const std::byte>>::encode(writer, std::span<const std::byte>(bytes));
+
+        /// Decoded views point into the buffer instead of copying it
+        IPC::BufferReader reader(buffer.data(), writer.size());
+        std::string_view text = IPC::Codec<std::string_view>::decode(reader);
+        CHECK(text == "view");
+        CHECK(text.data() >= buffer.data() && text.data() < buffer.data() + buffer.size());
+        std::span<const std::byte> span = IPC::Codec<std::span<const std::byte>>::decode(reader);
+        CHECK(span.size() == 3 && span[2] == std::byte{ 3 });
+        CHECK(reader.remaining() == 0);
+    }
+
+    void testBlocks() {
+        CHECK((roundTrip<Point>({ 1.5, -2 }) == Point{ 1.5, -2 }));
+        CHECK((roundTrip<std::array<int, 3>>({ 1, 2, 3 }) == std::array<int, 3>{ 1, 2, 3 }));
+        CHECK(roundTrip<Color>(Color::BLUE) == Color::BLUE);
+        CHECK(IPC::Codec<Point>::size({}) == sizeof(Point));
+    }
+
+    void testVectors() {
+        std::vector<int> numbers = { 1, -2, 3 };
+        CHECK(roundTrip(numbers) == numbers);
+        CHECK(IPC::Codec<std::vector<int>>::size(numbers) == 1 + 3 * sizeof(int));
+
+        std::vector<bool> flags = { true, false, true };
+        CHECK(roundTrip(flags) == flags);
+
+        std::vector<std::string> names = { "a", "", "ccc" };
+        CHECK(roundTrip(names) == names);
+
+        std::vector<Point> points = { { 0, 0 }, { 3, 4 } };
+        CHECK(roundTrip(points) == points);
+
+        std::vector<std::vector<int>> nested = { {}, { 1 }, { 2, 3 } };
+        CHECK(roundTrip(nested) == nested);
+    }
+
+    void testTruncated() {
+        std::vector<char> buffer(IPC::Codec<std::string>::size("truncated"));
+        IPC::BufferWriter writer(buffer.data(), buffer.size());
+        IPC::Codec<std::string>::encode(writer, "truncated");
+
+        IPC::BufferReader reader(buffer.data(), buffer.size() - 1);
+        CHECK_THROWS(std::runtime_error, IPC::Codec<std::string>::decode(reader));
+
+        /// Writing past the end is remembered instead of thrown
+        char small[2];
+        IPC::BufferWriter small_writer(small, sizeof(small));
+        IPC::Codec<std::string>::encode(small_writer, "too long");
+        CHECK(small_writer.overflowed());
+    }
+
+    void testSignatures() {
+        CHECK(IPC::FunctionTraits<int(int)>::schemaHash() != IPC::FunctionTraits<int(double)>::schemaHash());
+        CHECK(IPC::FunctionTraits<int(int)>::schemaHash() != IPC::FunctionTraits<IPC::Stream<int>(int)>::schemaHash());
+
+        auto args = IPC::FunctionTraits<int(int, std::string)>::argsSize(7, std::string("ab"));
+        std::vector<char> buffer(args);
+        IPC::BufferWriter writer(buffer.data(), buffer.size());
+        IPC::FunctionTraits<int(int, std::string)>::encodeArgs(writer, 7, std::string("ab"));
+        IPC::BufferReader reader(buffer.data(), buffer.size());
+        auto decoded = IPC::FunctionTraits<int(int, std::string)>::decodeArgs(reader);
+        CHECK(std::get<0>(decoded) == 7 && std::get<1>(decoded) == "ab");
+    }
+
+    /// Only the views with a codec of their own pass, a struct with a pointer member is not detected
+    static_assert(IPC::is_block_v<Point> && IPC::is_block_v<Color> && IPC::is_block_v<std::array<int, 3>>);
+    static_assert(!IPC::is_block_v<int*> && !IPC::is_block_v<std::span<int>> && !IPC::is_block_v<std::wstring_view>);
+    static_assert(!IPC::is_block_v<std::span<const std::byte, 4>>);
+    static_assert(IPC::is_block_v<WithPointer>);
+}
+
+int main() {
+    testScalars();
+    testVarints();
+    testStrings();
+    testViews();
+    testBlocks();
+    testVectors();
+    testTruncated();
+    testSignatures();
+    Test::finish();
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <fn/fn_channel.h>
+#include <fn/fn_registry.h>
+#include <fn/fn_stats.h>
+
+/**
+ * Checks shared by the tests. Every test is an executable run by ctest, it prints the failed checks and exits
+ * with a non-zero code if there are any.
+ */
+namespace Test {
+    inline int failures = 0;
+
+    inline void check(bool passed, const char* condition, const char* file, int line) {
+        if (!passed) {
+            std::cerr << file << ":" << line << ": CHECK(" << condition << ") failed" << std::endl;
+            failures++;
+        }
+    }
+
+    /// Runs the statement and returns true if it throws an Error.
+    template <typename Error, typename Statement>
+    bool throws(Statement statement) {
+        try {
+            statement();
+        }
+        catch (const Error&) {
+            return true;
+        }
+        catch (...) {
+            return false;
+        }
+        return false;
+    }
+
+    /// Name of a channel only this test process uses, so that the tests can run in parallel.
+    inline std::string getChannelName(const std::string& test) {
+        return test + "-test-" + std::to_string(getpid());
+    }
+
+    /// Options of an invoker that gives up quickly on a broken registry instead of hanging the test.
+    inline IPC::ChannelOptions getInvokerOptions() {
+        IPC::ChannelOptions options;
+        options.connect_timeout_ms = 5000;
+        options.call_timeout_ms = 5000;
+        return options;
+    }
+
+    /**
+     * Runs a registry on a thread of the test process. The setup registers the functions, listen() does not
+     * return, so the test ends with finish().
+     */
+    template <typename Setup>
+    void startRegistry(const std::string& channel_name, IPC::ChannelOptions options, Setup setup) {
+        std::thread([channel_name, options, setup] {
+            IPC::FunctionRegistry registry(channel_name, options);
+            setup(registry);
+            registry.listen();
+            }).detach();
+    }
+
+    /**
+     * Removes the shared memory of the registries the test started and exits with the result of the checks,
+     * without unwinding the threads of the registries.
+     */
+    inline void finish(std::initializer_list<std::string> channel_names = {}) {
+        for (const std::string& channel_name : channel_names) {
+            shm_unlink(channel_name.c_str());
+            shm_unlink(IPC::Stats::getShmName(channel_name).c_str());
+        }
+
+        std::cout << (failures == 0 ? "passed" : "FAILED") << std::endl;
+        _exit(failures == 0 ? 0 : 1);
+    }
+}
+
+#define CHECK(condition) Test::check((condition), #condition, __FILE__, __LINE__)
+#define CHECK_THROWS(Error, statement) Test::check(Test::throws<Error>([&] { statement; }), #statement, __FILE__, __LINE__)